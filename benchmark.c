@@ -0,0 +1,221 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "genann.h"
+
+/* Times the main genann operations over a range of topologies and prints
+ * the results as JSON, one object per operation and topology.
+ *
+ * Usage: benchmark [seconds per measurement, default 0.25] */
+
+typedef struct {
+    int inputs, hidden_layers, hidden, outputs;
+} topology;
+
+static const topology topologies[] = {
+    {2, 1, 2, 1},        /* XOR */
+    {4, 1, 4, 3},        /* Iris */
+    {32, 1, 32, 8},
+    {128, 2, 128, 10},
+    {256, 2, 256, 10},
+    {784, 1, 128, 10},   /* MNIST sized */
+    {1024, 1, 1024, 10},
+    {1024, 3, 1024, 10},
+};
+
+#define BATCH 64
+
+static double min_time = .25;
+static int first_result = 1;
+
+static genann *ann;
+static genann_sparse *sparse;
+static genann_real *inputs, *outputs;
+static FILE *text, *binary;
+static long file_size;
+
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+
+/* Each operation does one unit of work and returns how many samples it
+ * processed, or 0 if it has no samples. */
+
+static int op_run(void) {
+    genann_run(ann, inputs);
+    return 1;
+}
+
+static int op_train(void) {
+    genann_train(ann, inputs, outputs, .001);
+    return 1;
+}
+
+static int op_run_batch(void) {
+    genann_run_batch(ann, inputs, BATCH, outputs);
+    return BATCH;
+}
+
+static int op_train_batch(void) {
+    genann_train_batch(ann, inputs, outputs, BATCH, .001);
+    return BATCH;
+}
+
+static int op_run_sparse(void) {
+    genann_sparse_run(sparse, inputs);
+    return 1;
+}
+
+static int op_train_sparse(void) {
+    genann_sparse_train(sparse, inputs, outputs, .001);
+    return 1;
+}
+
+static int op_copy(void) {
+    genann_free(genann_copy(ann));
+    return 0;
+}
+
+/* Each file only ever holds one ann, so rewriting it leaves no stale tail. */
+static int op_write(void) {
+    rewind(text);
+    genann_write(ann, text);
+    fflush(text);
+    file_size = ftell(text);
+    return 0;
+}
+
+static int op_read(void) {
+    rewind(text);
+    genann_free(genann_read(text));
+    return 0;
+}
+
+static int op_write_binary(void) {
+    rewind(binary);
+    genann_write_binary(ann, binary);
+    fflush(binary);
+    file_size = ftell(binary);
+    return 0;
+}
+
+static int op_read_binary(void) {
+    rewind(binary);
+    genann_free(genann_read_binary(binary));
+    return 0;
+}
+
+
+/* Repeats op until min_time has passed and prints how long each call took.
+ * flops is the work per sample, and bytes the memory or file size per
+ * weight. */
+static void measure(const char *name, topology const *t, int (*op)(void), double flops, double bytes) {
+    long long calls = 0, samples = 0;
+
+    /* One untimed call to warm the caches. */
+    op();
+
+    const double start = now();
+    double elapsed;
+    do {
+        samples += op();
+        ++calls;
+        elapsed = now() - start;
+    } while (elapsed < min_time);
+
+    const double ns = elapsed * 1e9 / calls;
+
+    printf("%s\n    {\"op\": \"%s\", \"topology\": [%d, %d, %d, %d], \"weights\": %d, "
+            "\"ns_per_call\": %.1f",
+            first_result ? "" : ",", name, t->inputs, t->hidden_layers, t->hidden, t->outputs,
+            ann->total_weights, ns);
+
+    if (samples) {
+        const double ns_sample = elapsed * 1e9 / samples;
+        printf(", \"ns_per_sample\": %.1f, \"samples_per_sec\": %.1f, \"gflops\": %.3f",
+                ns_sample, 1e9 / ns_sample, flops / ns_sample);
+    }
+
+    printf(", \"bytes_per_weight\": %.2f}", bytes);
+    first_result = 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1) min_time = atof(argv[1]);
+
+    srand(1);
+
+    printf("{\"real_bytes\": %d, \"batch\": %d, \"results\": [", (int)sizeof(genann_real), BATCH);
+
+    unsigned i;
+    int j;
+    for (i = 0; i < sizeof(topologies) / sizeof(topologies[0]); ++i) {
+        topology const *t = topologies + i;
+        ann = genann_init(t->inputs, t->hidden_layers, t->hidden, t->outputs);
+        inputs = malloc(sizeof(genann_real) * BATCH * t->inputs);
+        outputs = malloc(sizeof(genann_real) * BATCH * t->outputs);
+        text = tmpfile();
+        binary = tmpfile();
+        if (!ann || !inputs || !outputs || !text || !binary) {
+            printf("Out of memory.\n");
+            return 1;
+        }
+
+        for (j = 0; j < BATCH * t->inputs; ++j) inputs[j] = GENANN_RANDOM();
+        for (j = 0; j < BATCH * t->outputs; ++j) outputs[j] = GENANN_RANDOM();
+
+        /* A multiply and an add per weight forward, and about twice that
+         * again to backpropagate and update. */
+        const double w = ann->total_weights;
+        const double run_flops = 2 * w;
+        const double train_flops = 6 * w;
+        const double memory = (sizeof(genann_real) * (w + 2.0 * ann->total_neurons) + sizeof(genann)) / w;
+
+        measure("run", t, op_run, run_flops, memory);
+        measure("train", t, op_train, train_flops, memory);
+        measure("run_batch", t, op_run_batch, run_flops, memory);
+        measure("train_batch", t, op_train_batch, train_flops, memory);
+        measure("copy", t, op_copy, 0, memory);
+
+        /* 90% pruned; flops count only the connections that remain, and
+         * memory is per weight of the dense ann. */
+        sparse = genann_prune(ann, genann_prune_threshold(ann, .9));
+        if (!sparse) {
+            printf("Out of memory.\n");
+            return 1;
+        }
+        const double kept = sparse->total_weights + (ann->total_neurons - ann->inputs);
+        const double sparse_memory = ((sizeof(genann_real) + sizeof(int)) * sparse->total_weights
+                + sizeof(genann_real) * 4.0 * ann->total_neurons + sizeof(genann_sparse)) / w;
+        measure("run_sparse", t, op_run_sparse, 2 * kept, sparse_memory);
+        measure("train_sparse", t, op_train_sparse, 6 * kept, sparse_memory);
+        genann_sparse_free(sparse);
+
+        op_write();
+        measure("write", t, op_write, 0, file_size / w);
+        measure("read", t, op_read, 0, file_size / w);
+
+        op_write_binary();
+        measure("write_binary", t, op_write_binary, 0, file_size / w);
+        measure("read_binary", t, op_read_binary, 0, file_size / w);
+
+        genann_free(ann);
+        free(inputs);
+        free(outputs);
+        fclose(text);
+        fclose(binary);
+    }
+
+    printf("\n]}\n");
+
+    return 0;
+}
@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "genann_dataset.h"
+
+/* Converts a CSV file to the binary format read by genann_dataset_open.
+ * Each line holds the inputs, then the desired outputs or a class name. */
+
+int main(int argc, char *argv[])
+{
+    if (argc != 5) {
+        printf("Usage: %s <in.csv> <out.bin> <inputs> <outputs>\n", argv[0]);
+        return 1;
+    }
+
+    const int inputs = atoi(argv[3]);
+    const int outputs = atoi(argv[4]);
+
+    FILE *in = fopen(argv[1], "r");
+    if (!in) {
+        printf("Could not open file: %s\n", argv[1]);
+        return 1;
+    }
+
+    FILE *out = fopen(argv[2], "wb");
+    if (!out) {
+        printf("Could not open file: %s\n", argv[2]);
+        fclose(in);
+        return 1;
+    }
+
+    const long long rows = genann_dataset_convert_csv(in, out, inputs, outputs);
+    fclose(in);
+
+    if (fclose(out) || rows < 0) {
+        printf("Could not convert %s.\n", argv[1]);
+        remove(argv[2]);
+        return 1;
+    }
+
+    printf("Wrote %lld rows of %d inputs and %d outputs to %s.\n", rows, inputs, outputs, argv[2]);
+
+    return 0;
+}
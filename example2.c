@@ -21,6 +21,9 @@ int main(int argc, char *argv[])
      * and 1 output. */
     genann *ann = genann_init(2, 1, 2, 1);
 
+    /* Holds the best weights so far. */
+    genann *save = genann_copy(ann);
+
     double err;
     double last_err = 1000;
     int count = 0;
@@ -33,7 +36,7 @@ int main(int argc, char *argv[])
             last_err = 1000;
         }
 
-        genann *save = genann_copy(ann);
+        genann_copy_weights(save, ann);
 
         /* Take a random guess at the ANN weights. */
         for (i = 0; i < ann->total_weights; ++i) {
@@ -49,11 +52,9 @@ int main(int argc, char *argv[])
 
         /* Keep these weights if they're an improvement. */
         if (err < last_err) {
-            genann_free(save);
             last_err = err;
         } else {
-            genann_free(ann);
-            ann = save;
+            genann_copy_weights(ann, save);
         }
 
     } while (err > 0.01);
@@ -66,6 +67,7 @@ int main(int argc, char *argv[])
     printf("Output for [%1.f, %1.f] is %1.f.\n", input[2][0], input[2][1], *genann_run(ann, input[2]));
     printf("Output for [%1.f, %1.f] is %1.f.\n", input[3][0], input[3][1], *genann_run(ann, input[3]));
 
+    genann_free(save);
     genann_free(ann);
     return 0;
 }
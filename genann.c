@@ -26,22 +26,57 @@
 #include "genann.h"
 
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
 #include <limits.h>
 #include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#define LOOKUP_SIZE 4096
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(GENANN_NO_MMAP)
+#define GENANN_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 /* Bounds the size calculations in genann_init so they cannot overflow. */
 #define GENANN_MAX_DIMENSION (1 << 20)
 
+/* How many samples genann_run_batch pushes through a layer at once, and
+ * how many inputs of each weight row it consumes before moving on to the
+ * next row. Together they keep the block of layer inputs in L1 while each
+ * weight is reused for every sample in the block. */
+#ifndef GENANN_BATCH_SAMPLES
+#define GENANN_BATCH_SAMPLES 16
+#endif
+#ifndef GENANN_BATCH_INPUTS
+#define GENANN_BATCH_INPUTS 256
+#endif
+
+/* genann_export_c writes layers of up to this many weights as straight-line
+ * code with the weights inline, and larger ones as loops over arrays. */
+#ifndef GENANN_EXPORT_UNROLL
+#define GENANN_EXPORT_UNROLL 256
+#endif
+
+/* genann_act_sigmoid_cached interpolates linearly between this many evenly
+ * spaced points on [-15, 15]. 1024 keeps the table in L1 with an error
+ * under 2e-5. */
+#ifndef GENANN_SIGMOID_LOOKUP_SIZE
+#define GENANN_SIGMOID_LOOKUP_SIZE 1024
+#endif
+
 static const double sigmoid_dom_min = -15.0;
 static const double sigmoid_dom_max = 15.0;
-static double interval;
-static double lookup[LOOKUP_SIZE];
+
+/* Filled in once, before main where the compiler allows, and never written
+ * again. The extra entry is the value at sigmoid_dom_max itself. */
+static genann_real lookup[GENANN_SIGMOID_LOOKUP_SIZE + 1];
+static int lookup_ready;
 
 #ifdef __GNUC__
 #define likely(x)       __builtin_expect(!!(x), 1)
@@ -55,363 +90,2587 @@ static double lookup[LOOKUP_SIZE];
 #endif
 
 
-double genann_act_sigmoid(const genann *ann unused, double a) {
+/* With GENANN_STATS, genann_forward and genann_backward time each layer and
+ * count the work done against the weights. Without it the macros below
+ * expand to nothing, and the hot paths are unchanged. */
+#ifdef GENANN_STATS
+#include <time.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define genann_cycles() ((unsigned long long)__builtin_ia32_rdtsc())
+#else
+#define genann_cycles() ((unsigned long long)clock())
+#endif
+
+/* Relaxed atomics keep the counts exact when threads train or run at once,
+ * without ordering anything else. */
+#ifdef __GNUC__
+#define GENANN_STAT_ADD(field, n) __atomic_fetch_add(&stats.field, (unsigned long long)(n), __ATOMIC_RELAXED)
+#else
+#define GENANN_STAT_ADD(field, n) (stats.field += (unsigned long long)(n))
+#endif
+
+#define GENANN_STAT_LAYER(l) ((l) <= GENANN_STATS_LAYERS ? (l) - 1 : GENANN_STATS_LAYERS - 1)
+#define GENANN_STAT_START(t) const unsigned long long t = genann_cycles()
+#define GENANN_STAT_CYCLES(field, l, t) GENANN_STAT_ADD(field[GENANN_STAT_LAYER(l)], genann_cycles() - (t))
+
+static genann_stats stats;
+#else
+#define GENANN_STAT_ADD(field, n) ((void)0)
+#define GENANN_STAT_START(t)
+#define GENANN_STAT_CYCLES(field, l, t) ((void)0)
+#endif
+
+
+/* The hot loops are written once below with GCC vector extensions, using
+ * vectors of a fixed GENANN_VEC_LANES values. On x86 each kernel is also
+ * compiled for AVX2 and AVX-512, and the dynamic loader picks the best one
+ * for the running CPU (via CPUID), so a portable build still gets the wide
+ * instructions. Elsewhere, e.g. NEON, the compiler maps the vectors onto
+ * what the target has. Lanes are always combined in the same order; only
+ * the AVX-512 kernels fuse multiply-adds, which can change the last bit of a
+ * result. Define GENANN_NO_SIMD to get plain C loops. */
+#if defined(__GNUC__) && !defined(GENANN_NO_SIMD)
+#define GENANN_SIMD
+typedef genann_real genann_vec __attribute__((vector_size(64)));
+#define GENANN_VEC_LANES ((int)(sizeof(genann_vec) / sizeof(genann_real)))
+#if defined(__has_attribute) && (defined(__x86_64__) || defined(__i386__)) && defined(__ELF__)
+#if __has_attribute(target_clones)
+#define GENANN_KERNEL __attribute__((target_clones("avx512f", "avx2", "default")))
+#endif
+#endif
+#endif
+
+#ifndef GENANN_KERNEL
+#define GENANN_KERNEL
+#endif
+
+
+#ifdef GENANN_SIMD
+/* Unaligned view used to load and store vectors anywhere in a buffer. */
+typedef genann_real genann_uvec __attribute__((vector_size(64), aligned(sizeof(genann_real)), may_alias));
+#define genann_vload(p) (*(genann_uvec const *)(p))
+#define genann_vstore(p, v) (*(genann_uvec *)(p) = (v))
+
+static inline genann_real genann_vsum(genann_vec const *v) {
+    genann_real sum = 0;
+    int l;
+    for (l = 0; l < GENANN_VEC_LANES; ++l) sum += (*v)[l];
+    return sum;
+}
+#endif
+
+
+/* Returns the sum of a[k] * b[k] for k < n. */
+GENANN_KERNEL
+static genann_real genann_dot(genann_real const *a, genann_real const *b, int n) {
+    genann_real sum = 0;
+    int k = 0;
+
+#ifdef GENANN_SIMD
+    const int L = GENANN_VEC_LANES;
+    if (n >= 2 * L) {
+        genann_vec acc0 = {0}, acc1 = {0};
+        for (; k + 2 * L <= n; k += 2 * L) {
+            acc0 += genann_vload(a + k) * genann_vload(b + k);
+            acc1 += genann_vload(a + k + L) * genann_vload(b + k + L);
+        }
+        acc0 += acc1;
+        sum = genann_vsum(&acc0);
+    }
+#endif
+
+    for (; k < n; ++k) sum += a[k] * b[k];
+    return sum;
+}
+
+
+/* Does y[k] += a * x[k] for k < n. */
+GENANN_KERNEL
+static void genann_axpy(genann_real *y, genann_real a, genann_real const *x, int n) {
+    int k = 0;
+
+#ifdef GENANN_SIMD
+    const int L = GENANN_VEC_LANES;
+    for (; k + L <= n; k += L) {
+        genann_vstore(y + k, genann_vload(y + k) + a * genann_vload(x + k));
+    }
+#endif
+
+    for (; k < n; ++k) y[k] += a * x[k];
+}
+
+
+/* For a block of b samples stored neuron-major, does
+ * y[s] += w[k] * x[k*b + s] for k < n, in order of k. */
+GENANN_KERNEL
+static void genann_row_block(genann_real const *w, genann_real const *x, genann_real *y, int n, int b) {
+    int k, s = 0;
+
+#ifdef GENANN_SIMD
+    const int L = GENANN_VEC_LANES;
+    for (; s + 2 * L <= b; s += 2 * L) {
+        genann_vec acc0 = genann_vload(y + s), acc1 = genann_vload(y + s + L);
+        for (k = 0; k < n; ++k) {
+            acc0 += w[k] * genann_vload(x + k * b + s);
+            acc1 += w[k] * genann_vload(x + k * b + s + L);
+        }
+        genann_vstore(y + s, acc0);
+        genann_vstore(y + s + L, acc1);
+    }
+    for (; s + L <= b; s += L) {
+        genann_vec acc = genann_vload(y + s);
+        for (k = 0; k < n; ++k) {
+            acc += w[k] * genann_vload(x + k * b + s);
+        }
+        genann_vstore(y + s, acc);
+    }
+#endif
+
+    for (; s < b; ++s) {
+        genann_real sum = y[s];
+        for (k = 0; k < n; ++k) sum += w[k] * x[k * b + s];
+        y[s] = sum;
+    }
+}
+
+
+/* For a block of b samples stored neuron-major, scatters one neuron's
+ * deltas dd back through its weights: d[j*b + s] += w[j] * dd[s], j < n. */
+GENANN_KERNEL
+static void genann_scatter_block(genann_real const *w, genann_real const *dd, genann_real *d, int n, int b) {
+    int j, s = 0;
+
+#ifdef GENANN_SIMD
+    const int L = GENANN_VEC_LANES;
+    for (; s + L <= b; s += L) {
+        const genann_vec v = genann_vload(dd + s);
+        for (j = 0; j < n; ++j) {
+            genann_vstore(d + j * b + s, genann_vload(d + j * b + s) + w[j] * v);
+        }
+    }
+#endif
+
+    for (; s < b; ++s) {
+        for (j = 0; j < n; ++j) d[j * b + s] += w[j] * dd[s];
+    }
+}
+
+
+/* Returns the sum of a[k] * b[k] for k < n, for 8-bit values. Partial sums
+ * are kept in 32 bits, which cannot overflow within one chunk. */
+#define GENANN_Q8_CHUNK 65536
+
+GENANN_KERNEL
+static long long genann_dot_q8(signed char const *a, signed char const *b, int n) {
+    long long sum = 0;
+    int k = 0;
+
+    while (k < n) {
+        const int end = n - k > GENANN_Q8_CHUNK ? k + GENANN_Q8_CHUNK : n;
+        int acc = 0;
+
+#if defined(GENANN_SIMD) && defined(__has_builtin)
+#if __has_builtin(__builtin_convertvector)
+        typedef signed char v8 __attribute__((vector_size(16), aligned(1), may_alias));
+        typedef short v16 __attribute__((vector_size(32)));
+        typedef int v32 __attribute__((vector_size(64)));
+        v32 vacc = {0};
+        for (; k + 16 <= end; k += 16) {
+            /* Products of two int8 values always fit in 16 bits. */
+            const v16 p = __builtin_convertvector(*(v8 const *)(a + k), v16)
+                * __builtin_convertvector(*(v8 const *)(b + k), v16);
+            vacc += __builtin_convertvector(p, v32);
+        }
+        int l;
+        for (l = 0; l < 16; ++l) acc += vacc[l];
+#endif
+#endif
+
+        for (; k < end; ++k) acc += a[k] * b[k];
+        sum += acc;
+    }
+
+    return sum;
+}
+
+
+/* Returns the sum of w[k] * x[index[k]] for k < n. Four running sums hide
+ * the latency of the gathered loads. */
+GENANN_KERNEL
+static genann_real genann_dot_sparse(genann_real const *w, int const *index, genann_real const *x, int n) {
+    genann_real s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    int k = 0;
+
+    for (; k + 4 <= n; k += 4) {
+        s0 += w[k] * x[index[k]];
+        s1 += w[k+1] * x[index[k+1]];
+        s2 += w[k+2] * x[index[k+2]];
+        s3 += w[k+3] * x[index[k+3]];
+    }
+    for (; k < n; ++k) s0 += w[k] * x[index[k]];
+
+    return (s0 + s1) + (s2 + s3);
+}
+
+
+/* Does w[k] += a * x[index[k]] for k < n. */
+GENANN_KERNEL
+static void genann_axpy_sparse(genann_real *w, int const *index, genann_real a, genann_real const *x, int n) {
+    int k;
+    for (k = 0; k < n; ++k) w[k] += a * x[index[k]];
+}
+
+
+genann_real genann_act_sigmoid(const genann *ann unused, genann_real a) {
     if (a < -45.0) return 0;
     if (a > 45.0) return 1;
     return 1.0 / (1 + exp(-a));
 }
 
-void genann_init_sigmoid_lookup(const genann *ann) {
-        const double f = (sigmoid_dom_max - sigmoid_dom_min) / LOOKUP_SIZE;
-        int i;
+static void genann_fill_sigmoid_lookup(void) {
+    const double f = (sigmoid_dom_max - sigmoid_dom_min) / GENANN_SIGMOID_LOOKUP_SIZE;
+    int i;
 
-        interval = LOOKUP_SIZE / (sigmoid_dom_max - sigmoid_dom_min);
-        for (i = 0; i < LOOKUP_SIZE; ++i) {
-            lookup[i] = genann_act_sigmoid(ann, sigmoid_dom_min + f * i);
-        }
+    for (i = 0; i <= GENANN_SIGMOID_LOOKUP_SIZE; ++i) {
+        lookup[i] = genann_act_sigmoid(0, sigmoid_dom_min + f * i);
+    }
+    lookup_ready = 1;
 }
 
-double genann_act_sigmoid_cached(const genann *ann unused, double a) {
-    assert(!isnan(a));
+#ifdef __GNUC__
+__attribute__((constructor))
+static void genann_sigmoid_lookup_constructor(void) {
+    genann_fill_sigmoid_lookup();
+}
+#endif
+
+void genann_init_sigmoid_lookup(const genann *ann unused) {
+    /* Without a load-time constructor, the first call fills the table. */
+    if (!lookup_ready) genann_fill_sigmoid_lookup();
+}
 
-    if (a < sigmoid_dom_min) return lookup[0];
-    if (a >= sigmoid_dom_max) return lookup[LOOKUP_SIZE - 1];
+static inline genann_real genann_sigmoid_interpolate(genann_real a) {
+    const genann_real interval = GENANN_SIGMOID_LOOKUP_SIZE / (sigmoid_dom_max - sigmoid_dom_min);
 
-    size_t j = (size_t)((a-sigmoid_dom_min)*interval+0.5);
+    /* A NaN stays NaN. It must not reach the cast below, which would be
+     * undefined. */
+    if (isnan(a)) return a;
 
-    /* Because floating point... */
-    if (unlikely(j >= LOOKUP_SIZE)) return lookup[LOOKUP_SIZE - 1];
+    if (a < sigmoid_dom_min) a = sigmoid_dom_min;
+    if (a > sigmoid_dom_max) a = sigmoid_dom_max;
 
-    return lookup[j];
+    const genann_real t = (a - sigmoid_dom_min) * interval;
+    int j = (int)t;
+
+    /* Only at sigmoid_dom_max, or through rounding. */
+    if (j > GENANN_SIGMOID_LOOKUP_SIZE - 1) j = GENANN_SIGMOID_LOOKUP_SIZE - 1;
+    if (j < 0) j = 0;
+
+    return lookup[j] + (lookup[j + 1] - lookup[j]) * (t - j);
+}
+
+genann_real genann_act_sigmoid_cached(const genann *ann unused, genann_real a) {
+    assert(!isnan(a));
+    return genann_sigmoid_interpolate(a);
 }
 
-double genann_act_linear(const struct genann *ann unused, double a) {
+genann_real genann_act_linear(const struct genann *ann unused, genann_real a) {
     return a;
 }
 
-double genann_act_threshold(const struct genann *ann unused, double a) {
+genann_real genann_act_threshold(const struct genann *ann unused, genann_real a) {
     return a > 0;
 }
 
-double genann_act_tanh(const struct genann *ann unused, double a) {
+genann_real genann_act_tanh(const struct genann *ann unused, genann_real a) {
     return tanh(a);
 }
 
-double genann_act_relu(const struct genann *ann unused, double a) {
+genann_real genann_act_relu(const struct genann *ann unused, genann_real a) {
     return a > 0 ? a : 0;
 }
 
-genann *genann_init(int inputs, int hidden_layers, int hidden, int outputs) {
-    if (hidden_layers < 0) return 0;
-    if (inputs < 1) return 0;
-    if (outputs < 1) return 0;
-    if (hidden_layers > 0 && hidden < 1) return 0;
-    if (inputs > GENANN_MAX_DIMENSION || hidden_layers > GENANN_MAX_DIMENSION
-            || hidden > GENANN_MAX_DIMENSION || outputs > GENANN_MAX_DIMENSION) return 0;
 
+/* Derivatives of the built-in activations, in terms of their output. */
+static genann_real genann_der_sigmoid(const genann *ann unused, genann_real y) {
+    return y * (1.0 - y);
+}
 
-    const long long hidden_weights = hidden_layers ? (long long)(inputs+1) * hidden + (long long)(hidden_layers-1) * (hidden+1) * hidden : 0;
-    const long long output_weights = (long long)(hidden_layers ? (hidden+1) : (inputs+1)) * outputs;
-    const long long total_weights = (hidden_weights + output_weights);
+static genann_real genann_der_threshold(const genann *ann unused, genann_real y unused) {
+    return 0;
+}
 
-    const long long total_neurons = ((long long)inputs + (long long)hidden * hidden_layers + outputs);
+static genann_real genann_der_linear(const genann *ann unused, genann_real y unused) {
+    return 1.0;
+}
 
-    /* Reject networks too large for the int counters and buffer size below. */
-    if (total_weights > INT_MAX / 32 || total_neurons > INT_MAX / 32) return 0;
+static genann_real genann_der_tanh(const genann *ann unused, genann_real y) {
+    return 1.0 - y * y;
+}
 
-    /* Allocate extra size for weights, outputs, and deltas. */
-    const int size = sizeof(genann) + sizeof(double) * (total_weights + total_neurons + (total_neurons - inputs));
-    genann *ret = malloc(size);
-    if (!ret) return 0;
+static genann_real genann_der_relu(const genann *ann unused, genann_real y) {
+    return y > 0 ? 1.0 : 0.0;
+}
 
-    ret->inputs = inputs;
-    ret->hidden_layers = hidden_layers;
-    ret->hidden = hidden;
-    ret->outputs = outputs;
 
-    ret->total_weights = total_weights;
-    ret->total_neurons = total_neurons;
+/* Whole-layer forms of each built-in activation and its derivative. The
+ * scalar functions are inlined, so there is no call per neuron, and the
+ * simpler ones vectorize. */
+#define GENANN_LAYER_ACTIVATION(name) \
+GENANN_KERNEL \
+static void genann_layer_##name(const genann *ann, genann_real *a, int n) { \
+    int i; \
+    for (i = 0; i < n; ++i) a[i] = genann_act_##name(ann, a[i]); \
+} \
+GENANN_KERNEL \
+static void genann_layer_der_##name(const genann *ann, genann_real const *y, genann_real *d, int n) { \
+    int i; \
+    for (i = 0; i < n; ++i) d[i] *= genann_der_##name(ann, y[i]); \
+}
 
-    /* Set pointers. */
-    ret->weight = (double*)((char*)ret + sizeof(genann));
-    ret->output = ret->weight + ret->total_weights;
-    ret->delta = ret->output + ret->total_neurons;
+GENANN_LAYER_ACTIVATION(sigmoid)
+GENANN_LAYER_ACTIVATION(threshold)
+GENANN_LAYER_ACTIVATION(linear)
+GENANN_LAYER_ACTIVATION(tanh)
+GENANN_LAYER_ACTIVATION(relu)
 
-    genann_randomize(ret);
+/* The lookup over a whole layer, without the per-value NaN assert. */
+GENANN_KERNEL
+static void genann_layer_sigmoid_cached(const genann *ann unused, genann_real *a, int n) {
+    int i;
+    for (i = 0; i < n; ++i) a[i] = genann_sigmoid_interpolate(a[i]);
+}
 
-    ret->activation_hidden = genann_act_sigmoid_cached;
-    ret->activation_output = genann_act_sigmoid_cached;
+#define genann_der_sigmoid_cached genann_der_sigmoid
+#define genann_layer_der_sigmoid_cached genann_layer_der_sigmoid
+
+#define GENANN_BUILTIN_ACTIVATION(id, name) \
+const genann_activation genann_activation_##name = { \
+    id, genann_act_##name, genann_der_##name, genann_layer_##name, genann_layer_der_##name \
+};
+
+GENANN_BUILTIN_ACTIVATION(GENANN_ACT_SIGMOID_CACHED, sigmoid_cached)
+GENANN_BUILTIN_ACTIVATION(GENANN_ACT_SIGMOID, sigmoid)
+GENANN_BUILTIN_ACTIVATION(GENANN_ACT_THRESHOLD, threshold)
+GENANN_BUILTIN_ACTIVATION(GENANN_ACT_LINEAR, linear)
+GENANN_BUILTIN_ACTIVATION(GENANN_ACT_TANH, tanh)
+GENANN_BUILTIN_ACTIVATION(GENANN_ACT_RELU, relu)
+
+/* Indexed by id, which is also how activations are saved to files. */
+static genann_activation const *const genann_builtin_activations[] = {
+    &genann_activation_sigmoid_cached,
+    &genann_activation_sigmoid,
+    &genann_activation_threshold,
+    &genann_activation_linear,
+    &genann_activation_tanh,
+    &genann_activation_relu
+};
+#define GENANN_BUILTIN_ACTIVATIONS ((int)(sizeof(genann_builtin_activations) / sizeof(genann_builtin_activations[0])))
+
+
+/* Finds the descriptor for activation function act. The descriptor set with
+ * genann_set_activation_* is used as long as the function pointer still
+ * matches it; otherwise act is looked up among the built-ins. Other functions
+ * get a descriptor with only the function itself. */
+static genann_activation genann_find_activation(genann_actfun act, genann_activation const *desc) {
+    int i;
 
-    genann_init_sigmoid_lookup(ret);
+    if (desc && desc->forward == act) return *desc;
 
-    return ret;
-}
+    for (i = 0; i < GENANN_BUILTIN_ACTIVATIONS; ++i) {
+        if (genann_builtin_activations[i]->forward == act) return *genann_builtin_activations[i];
+    }
 
+    genann_activation custom = {GENANN_ACT_CUSTOM, act, 0, 0, 0};
+    return custom;
+}
 
-genann *genann_read(FILE *in) {
-    int inputs, hidden_layers, hidden, outputs;
-    int rc;
 
-    errno = 0;
-    rc = fscanf(in, "%d %d %d %d", &inputs, &hidden_layers, &hidden, &outputs);
-    if (rc < 4 || errno != 0) {
-        perror("fscanf");
-        return NULL;
+/* Applies an activation to n values in place. */
+static void genann_activate(genann const *ann, genann_activation const *act, genann_real *a, int n) {
+    if (act->forward_layer) {
+        act->forward_layer(ann, a, n);
+    } else {
+        int i;
+        for (i = 0; i < n; ++i) a[i] = act->forward(ann, a[i]);
     }
+}
 
-    genann *ann = genann_init(inputs, hidden_layers, hidden, outputs);
-    if (!ann) return NULL;
 
+/* Multiplies each of n deltas by the activation's derivative at the matching
+ * output. Without a known derivative, the sigmoid's is assumed. */
+static void genann_activate_derivative(genann const *ann, genann_activation const *act,
+        genann_real const *y, genann_real *d, int n) {
     int i;
-    for (i = 0; i < ann->total_weights; ++i) {
-        errno = 0;
-        rc = fscanf(in, " %le", ann->weight + i);
-        if (rc < 1 || errno != 0) {
-            perror("fscanf");
-            genann_free(ann);
 
-            return NULL;
-        }
+    if (act->derivative_layer) {
+        act->derivative_layer(ann, y, d, n);
+    } else if (act->derivative) {
+        for (i = 0; i < n; ++i) d[i] *= act->derivative(ann, y[i]);
+    } else {
+        for (i = 0; i < n; ++i) d[i] *= genann_der_sigmoid(ann, y[i]);
     }
-
-    return ann;
 }
 
 
-genann *genann_copy(genann const *ann) {
-    const int size = sizeof(genann) + sizeof(double) * (ann->total_weights + ann->total_neurons + (ann->total_neurons - ann->inputs));
-    genann *ret = malloc(size);
-    if (!ret) return 0;
-
-    memcpy(ret, ann, size);
+/* Returns the activation of layer l, from 1 to ann->layers. */
+static genann_activation genann_layer_activation(genann const *ann, int l) {
+    if (ann->layer_activation[l]) return *ann->layer_activation[l];
+    if (l == ann->layers) return genann_find_activation(ann->activation_output, ann->activation_output_desc);
+    return genann_find_activation(ann->activation_hidden, ann->activation_hidden_desc);
+}
 
-    /* Set pointers. */
-    ret->weight = (double*)((char*)ret + sizeof(genann));
-    ret->output = ret->weight + ret->total_weights;
-    ret->delta = ret->output + ret->total_neurons;
 
-    return ret;
+void genann_set_activation_hidden(genann *ann, genann_activation const *act) {
+    int l;
+    ann->activation_hidden = act->forward;
+    ann->activation_hidden_desc = act;
+    for (l = 1; l < ann->layers; ++l) ann->layer_activation[l] = 0;
 }
 
 
-void genann_randomize(genann *ann) {
-    int i;
-    for (i = 0; i < ann->total_weights; ++i) {
-        double r = GENANN_RANDOM();
-        /* Sets weights from -0.5 to 0.5. */
-        ann->weight[i] = r - 0.5;
-    }
+void genann_set_activation_output(genann *ann, genann_activation const *act) {
+    ann->activation_output = act->forward;
+    ann->activation_output_desc = act;
+    ann->layer_activation[ann->layers] = 0;
 }
 
 
-void genann_free(genann *ann) {
-    /* The weight, output, and delta pointers go to the same buffer. */
-    free(ann);
+void genann_set_activation_layer(genann *ann, int layer, genann_activation const *act) {
+    assert(layer >= 1 && layer <= ann->layers);
+    ann->layer_activation[layer] = act;
 }
 
 
-double const *genann_run(genann const *ann, double const *inputs) {
-    double const *w = ann->weight;
-    double *o = ann->output + ann->inputs;
-    double const *i = ann->output;
+/* Every block from an arena starts on this boundary. Each is preceded by a
+ * header of the same size, which keeps the next block aligned too. */
+#define GENANN_ARENA_ALIGN 64
 
-    /* Copy the inputs to the scratch area, where we also store each neuron's
-     * output, for consistency. This way the first layer isn't a special case. */
-    memcpy(ann->output, inputs, sizeof(double) * ann->inputs);
+typedef struct genann_arena_block {
+    size_t size;
+    struct genann_arena_block *next;
+} genann_arena_block;
 
-    int h, j, k;
+struct genann_arena {
+    char *start, *top, *end;
 
-    if (!ann->hidden_layers) {
-        double *ret = o;
-        for (j = 0; j < ann->outputs; ++j) {
-            double sum = *w++ * -1.0;
-            for (k = 0; k < ann->inputs; ++k) {
-                sum += *w++ * i[k];
-            }
-            *o++ = ann->activation_output(ann, sum);
-        }
+    /* Blocks given back by genann_free, for reuse by anns of the same size. */
+    genann_arena_block *free;
+};
 
-        return ret;
-    }
 
-    /* Figure input layer */
-    for (j = 0; j < ann->hidden; ++j) {
-        double sum = *w++ * -1.0;
-        for (k = 0; k < ann->inputs; ++k) {
-            sum += *w++ * i[k];
-        }
-        *o++ = ann->activation_hidden(ann, sum);
-    }
+genann_arena *genann_arena_init(size_t bytes) {
+    bytes = (bytes + GENANN_ARENA_ALIGN - 1) & ~(size_t)(GENANN_ARENA_ALIGN - 1);
 
-    i += ann->inputs;
+    genann_arena *arena = malloc(sizeof(genann_arena) + GENANN_ARENA_ALIGN + bytes);
+    if (!arena) return 0;
 
-    /* Figure hidden layers, if any. */
-    for (h = 1; h < ann->hidden_layers; ++h) {
-        for (j = 0; j < ann->hidden; ++j) {
-            double sum = *w++ * -1.0;
-            for (k = 0; k < ann->hidden; ++k) {
-                sum += *w++ * i[k];
-            }
-            *o++ = ann->activation_hidden(ann, sum);
-        }
+    const uintptr_t p = (uintptr_t)(arena + 1);
+    arena->start = (char*)(arena + 1) + (GENANN_ARENA_ALIGN - p % GENANN_ARENA_ALIGN) % GENANN_ARENA_ALIGN;
+    arena->end = arena->start + bytes;
+    genann_arena_reset(arena);
+
+    return arena;
+}
+
+
+void genann_arena_reset(genann_arena *arena) {
+    arena->top = arena->start;
+    arena->free = 0;
+}
+
+
+void genann_arena_free(genann_arena *arena) {
+    /* Everything is in the one buffer. */
+    free(arena);
+}
 
-        i += ann->hidden;
-    }
 
-    double const *ret = o;
+static void *genann_arena_alloc(genann_arena *arena, size_t size) {
+    size = (size + GENANN_ARENA_ALIGN - 1) & ~(size_t)(GENANN_ARENA_ALIGN - 1);
 
-    /* Figure output layer. */
-    for (j = 0; j < ann->outputs; ++j) {
-        double sum = *w++ * -1.0;
-        for (k = 0; k < ann->hidden; ++k) {
-            sum += *w++ * i[k];
+    genann_arena_block **b;
+    for (b = &arena->free; *b; b = &(*b)->next) {
+        if ((*b)->size == size) {
+            genann_arena_block *found = *b;
+            *b = found->next;
+            return (char*)found + GENANN_ARENA_ALIGN;
         }
-        *o++ = ann->activation_output(ann, sum);
     }
 
-    /* Sanity check that we used all weights and wrote all outputs. */
-    assert(w - ann->weight == ann->total_weights);
-    assert(o - ann->output == ann->total_neurons);
+    if ((size_t)(arena->end - arena->top) < GENANN_ARENA_ALIGN + size) return 0;
 
-    return ret;
+    genann_arena_block *block = (genann_arena_block*)arena->top;
+    block->size = size;
+    arena->top += GENANN_ARENA_ALIGN + size;
+    return (char*)block + GENANN_ARENA_ALIGN;
 }
 
 
-/* Derivative of an activation function, in terms of its output value.
- * Recognizes the built-in activations; any other function is assumed to
- * have the sigmoid's derivative. */
-static double genann_act_derivative(genann_actfun act, double y) {
-    if (act == genann_act_tanh) return 1.0 - y * y;
-    if (act == genann_act_relu) return y > 0 ? 1.0 : 0.0;
-    if (act == genann_act_linear) return 1.0;
-    return y * (1.0 - y);
+static void genann_arena_release(genann_arena *arena, void *p) {
+    genann_arena_block *block = (genann_arena_block*)((char*)p - GENANN_ARENA_ALIGN);
+    block->next = arena->free;
+    arena->free = block;
 }
 
 
-void genann_train(genann const *ann, double const *inputs, double const *desired_outputs, double learning_rate) {
-    /* To begin with, we must run the network forward. */
-    genann_run(ann, inputs);
-
-    int h, j, k;
+/* Allocates an ann with nlayers layers of the given widths in one buffer,
+ * taken from arena if not NULL, leaving the weights and activations unset.
+ * Without with_weights, there is no room for the weights and ann->weight is
+ * left for the caller to point at. */
+static genann *genann_alloc_in(genann_arena *arena, int nlayers, int const *sizes, int with_weights) {
+    if (nlayers < 2 || nlayers > GENANN_MAX_DIMENSION) return 0;
 
-    /* First set the output layer deltas. */
-    {
-        double const *o = ann->output + ann->inputs + ann->hidden * ann->hidden_layers; /* First output. */
-        double *d = ann->delta + ann->hidden * ann->hidden_layers; /* First delta. */
-        double const *t = desired_outputs; /* First desired output. */
+    long long total_weights = 0, total_neurons = 0;
+    int hidden = 0;
+    int l;
 
+    for (l = 0; l < nlayers; ++l) {
+        if (sizes[l] < 1 || sizes[l] > GENANN_MAX_DIMENSION) return 0;
+        if (l) total_weights += (long long)(sizes[l-1] + 1) * sizes[l];
+        total_neurons += sizes[l];
+        if (l > 0 && l < nlayers - 1 && sizes[l] > hidden) hidden = sizes[l];
 
-        /* Set output layer deltas. */
-        if (ann->activation_output == genann_act_linear) {
-            for (j = 0; j < ann->outputs; ++j) {
-                *d++ = *t++ - *o++;
-            }
-        } else {
-            for (j = 0; j < ann->outputs; ++j) {
-                *d++ = (*t - *o) * genann_act_derivative(ann->activation_output, *o);
-                ++o; ++t;
-            }
-        }
+        /* Reject networks too large for the int counters and buffer size below. */
+        if (total_weights > INT_MAX / 32 || total_neurons > INT_MAX / 32) return 0;
     }
 
+    /* Allocate extra size for per-layer activations, weights, outputs,
+     * deltas and the per-layer tables. */
+    const size_t size = sizeof(genann) + sizeof(genann_activation const*) * nlayers
+        + sizeof(genann_real) * ((with_weights ? total_weights : 0) + total_neurons + (total_neurons - sizes[0]))
+        + sizeof(int) * 3 * nlayers;
+    genann *ret = arena ? genann_arena_alloc(arena, size) : malloc(size);
+    if (!ret) return 0;
+
+    ret->inputs = sizes[0];
+    ret->hidden_layers = nlayers - 2;
+    ret->hidden = hidden;
+    ret->outputs = sizes[nlayers - 1];
+    ret->layers = nlayers - 1;
 
-    /* Set hidden layer deltas, start on last layer and work backwards. */
-    /* Note that loop is skipped in the case of hidden_layers == 0. */
-    for (h = ann->hidden_layers - 1; h >= 0; --h) {
+    ret->total_weights = total_weights;
+    ret->total_neurons = total_neurons;
 
-        /* Find first output and delta in this layer. */
-        double const *o = ann->output + ann->inputs + (h * ann->hidden);
-        double *d = ann->delta + (h * ann->hidden);
+    /* Set pointers. */
+    ret->layer_activation = (genann_activation const**)((char*)ret + sizeof(genann));
+    ret->weight = with_weights ? (genann_real*)(ret->layer_activation + nlayers) : 0;
+    ret->output = (genann_real*)(ret->layer_activation + nlayers) + (with_weights ? ret->total_weights : 0);
+    ret->delta = ret->output + ret->total_neurons;
+    ret->layer_size = (int*)(ret->delta + (ret->total_neurons - ret->inputs));
+    ret->neuron_offset = ret->layer_size + nlayers;
+    ret->weight_offset = ret->neuron_offset + nlayers;
+
+    for (l = 0; l < nlayers; ++l) {
+        ret->layer_size[l] = sizes[l];
+        ret->neuron_offset[l] = l ? ret->neuron_offset[l-1] + sizes[l-1] : 0;
+        ret->weight_offset[l] = l > 1 ? ret->weight_offset[l-1] + (sizes[l-2] + 1) * sizes[l-1] : 0;
+        ret->layer_activation[l] = 0;
+    }
 
-        /* Find first delta in following layer (which may be hidden or output). */
-        double const * const dd = ann->delta + ((h+1) * ann->hidden);
+    ret->activation_hidden_desc = 0;
+    ret->activation_output_desc = 0;
 
-        /* Find first weight in following layer (which may be hidden or output). */
-        double const * const ww = ann->weight + ((ann->inputs+1) * ann->hidden) + ((ann->hidden+1) * ann->hidden * (h));
+    ret->mapping = 0;
+    ret->mapping_size = 0;
+    ret->arena = arena;
 
-        for (j = 0; j < ann->hidden; ++j) {
+    return ret;
+}
 
-            double delta = 0;
 
-            for (k = 0; k < (h == ann->hidden_layers-1 ? ann->outputs : ann->hidden); ++k) {
-                const double forward_delta = dd[k];
-                const int windex = k * (ann->hidden + 1) + (j + 1);
-                const double forward_weight = ww[windex];
-                delta += forward_delta * forward_weight;
-            }
+/* Like genann_alloc_in, with the memory from malloc. */
+static genann *genann_alloc(int nlayers, int const *sizes, int with_weights) {
+    return genann_alloc_in(0, nlayers, sizes, with_weights);
+}
 
-            *d = genann_act_derivative(ann->activation_hidden, *o) * delta;
-            ++d; ++o;
-        }
-    }
 
+/* Allocates an ann with hidden_layers layers of hidden neurons each, as
+ * genann_alloc does. */
+static genann *genann_alloc_uniform(genann_arena *arena, int inputs, int hidden_layers, int hidden, int outputs, int with_weights) {
+    if (hidden_layers < 0) return 0;
+    if (hidden_layers > 0 && hidden < 1) return 0;
+    if (hidden_layers > GENANN_MAX_DIMENSION - 2 || hidden > GENANN_MAX_DIMENSION) return 0;
 
-    /* Train the outputs. */
-    {
-        /* Find first output delta. */
-        double const *d = ann->delta + ann->hidden * ann->hidden_layers; /* First output delta. */
+    /* Usual depths need no allocation besides the ann. */
+    int small[16];
+    int *sizes = hidden_layers + 2 <= 16 ? small : malloc(sizeof(int) * (hidden_layers + 2));
+    if (!sizes) return 0;
 
-        /* Find first weight to first output delta. */
-        double *w = ann->weight + (ann->hidden_layers
-                ? ((ann->inputs+1) * ann->hidden + (ann->hidden+1) * ann->hidden * (ann->hidden_layers-1))
-                : (0));
+    int l;
+    sizes[0] = inputs;
+    for (l = 1; l <= hidden_layers; ++l) sizes[l] = hidden;
+    sizes[hidden_layers + 1] = outputs;
 
-        /* Find first output in previous layer. */
-        double const * const i = ann->output + (ann->hidden_layers
-                ? (ann->inputs + (ann->hidden) * (ann->hidden_layers-1))
-                : 0);
+    genann *ret = genann_alloc_in(arena, hidden_layers + 2, sizes, with_weights);
+    if (sizes != small) free(sizes);
 
-        /* Set output layer weights. */
-        for (j = 0; j < ann->outputs; ++j) {
-            *w++ += *d * learning_rate * -1.0;
-            for (k = 1; k < (ann->hidden_layers ? ann->hidden : ann->inputs) + 1; ++k) {
-                *w++ += *d * learning_rate * i[k-1];
-            }
+    /* Kept as given, even with no hidden layers. */
+    if (ret) ret->hidden = hidden;
 
-            ++d;
-        }
+    return ret;
+}
 
-        assert(w - ann->weight == ann->total_weights);
-    }
 
+/* Sets up a freshly allocated ann with random weights and the default
+ * activations. */
+static genann *genann_setup(genann *ret) {
+    if (!ret) return 0;
 
-    /* Train the hidden layers. */
-    for (h = ann->hidden_layers - 1; h >= 0; --h) {
+    genann_randomize(ret);
 
-        /* Find first delta in this layer. */
-        double const *d = ann->delta + (h * ann->hidden);
+    genann_set_activation_hidden(ret, &genann_activation_sigmoid_cached);
+    genann_set_activation_output(ret, &genann_activation_sigmoid_cached);
 
-        /* Find first input to this layer. */
-        double const *i = ann->output + (h
-                ? (ann->inputs + ann->hidden * (h-1))
-                : 0);
+    genann_init_sigmoid_lookup(ret);
 
-        /* Find first weight to this layer. */
-        double *w = ann->weight + (h
-                ? ((ann->inputs+1) * ann->hidden + (ann->hidden+1) * (ann->hidden) * (h-1))
-                : 0);
+    return ret;
+}
 
 
-        for (j = 0; j < ann->hidden; ++j) {
-            *w++ += *d * learning_rate * -1.0;
-            for (k = 1; k < (h == 0 ? ann->inputs : ann->hidden) + 1; ++k) {
-                *w++ += *d * learning_rate * i[k-1];
-            }
-            ++d;
-        }
+genann *genann_init(int inputs, int hidden_layers, int hidden, int outputs) {
+    return genann_setup(genann_alloc_uniform(0, inputs, hidden_layers, hidden, outputs, 1));
+}
 
-    }
 
+genann *genann_init_in(genann_arena *arena, int inputs, int hidden_layers, int hidden, int outputs) {
+    return genann_setup(genann_alloc_uniform(arena, inputs, hidden_layers, hidden, outputs, 1));
 }
 
 
-void genann_write(genann const *ann, FILE *out) {
-    fprintf(out, "%d %d %d %d", ann->inputs, ann->hidden_layers, ann->hidden, ann->outputs);
+genann *genann_init_layers(int nlayers, const int *sizes) {
+    return genann_setup(genann_alloc(nlayers, sizes, 1));
+}
 
-    int i;
-    for (i = 0; i < ann->total_weights; ++i) {
-        fprintf(out, " %.20e", ann->weight[i]);
+
+/* Returns whether all hidden layers are ann->hidden wide. */
+static int genann_uniform(genann const *ann) {
+    int l;
+    for (l = 1; l < ann->layers; ++l) {
+        if (ann->layer_size[l] != ann->hidden) return 0;
     }
+    return 1;
 }
 
 
+genann *genann_read(FILE *in) {
+    int inputs, hidden_layers, hidden, outputs;
+    int rc;
+    genann *ann;
+
+    errno = 0;
+    rc = fscanf(in, "%d", &inputs);
+    if (rc < 1 || errno != 0) {
+        perror("fscanf");
+        return NULL;
+    }
+
+    if (inputs < 0) {
+        /* Written by genann_write for layers of differing widths: the
+         * negated number of layers, then the width of each. Too many is
+         * caught before negating, which could overflow. */
+        if (inputs < -GENANN_MAX_DIMENSION) return NULL;
+        const int nlayers = -inputs;
+
+        int *sizes = malloc(sizeof(int) * nlayers);
+        if (!sizes) return NULL;
+
+        int l;
+        for (l = 0; l < nlayers; ++l) {
+            errno = 0;
+            rc = fscanf(in, "%d", &sizes[l]);
+            if (rc < 1 || errno != 0) {
+                perror("fscanf");
+                free(sizes);
+                return NULL;
+            }
+        }
+
+        ann = genann_init_layers(nlayers, sizes);
+        free(sizes);
+    } else {
+        errno = 0;
+        rc = fscanf(in, "%d %d %d", &hidden_layers, &hidden, &outputs);
+        if (rc < 3 || errno != 0) {
+            perror("fscanf");
+            return NULL;
+        }
+
+        ann = genann_init(inputs, hidden_layers, hidden, outputs);
+    }
+
+    if (!ann) return NULL;
+
+    int i;
+    for (i = 0; i < ann->total_weights; ++i) {
+        double w;
+        errno = 0;
+        rc = fscanf(in, " %le", &w);
+        if (rc < 1 || errno != 0) {
+            perror("fscanf");
+            genann_free(ann);
+
+            return NULL;
+        }
+        ann->weight[i] = w;
+    }
+
+    return ann;
+}
+
+
+/* Returns whether a and b have layers of the same widths. */
+static int genann_same_topology(genann const *a, genann const *b) {
+    int l;
+    if (a->layers != b->layers) return 0;
+    for (l = 0; l <= a->layers; ++l) {
+        if (a->layer_size[l] != b->layer_size[l]) return 0;
+    }
+    return 1;
+}
+
+
+int genann_copy_into(genann *dst, genann const *src) {
+    if (dst->mapping || !genann_same_topology(dst, src)) return -1;
+    if (dst == src) return 0;
+
+    dst->hidden = src->hidden;
+    dst->activation_hidden = src->activation_hidden;
+    dst->activation_output = src->activation_output;
+    dst->activation_hidden_desc = src->activation_hidden_desc;
+    dst->activation_output_desc = src->activation_output_desc;
+    memcpy(dst->layer_activation, src->layer_activation, sizeof(genann_activation const*) * (src->layers + 1));
+
+    /* The weights may not be in the same buffer as the rest, e.g. when they
+     * are mapped from a file, but the copy always owns all of its memory. */
+    memcpy(dst->weight, src->weight, sizeof(genann_real) * src->total_weights);
+    memcpy(dst->output, src->output, sizeof(genann_real) * (src->total_neurons + (src->total_neurons - src->inputs)));
+
+    return 0;
+}
+
+
+int genann_copy_weights(genann *dst, genann const *src) {
+    if (dst->mapping || !genann_same_topology(dst, src)) return -1;
+    if (dst != src) memcpy(dst->weight, src->weight, sizeof(genann_real) * src->total_weights);
+    return 0;
+}
+
+
+genann *genann_copy_in(genann_arena *arena, genann const *ann) {
+    genann *ret = genann_alloc_in(arena, ann->layers + 1, ann->layer_size, 1);
+    if (!ret) return 0;
+
+    genann_copy_into(ret, ann);
+    return ret;
+}
+
+
+genann *genann_copy(genann const *ann) {
+    return genann_copy_in(0, ann);
+}
+
+
+void genann_randomize(genann *ann) {
+    int i;
+    for (i = 0; i < ann->total_weights; ++i) {
+        double r = GENANN_RANDOM();
+        /* Sets weights from -0.5 to 0.5. */
+        ann->weight[i] = r - 0.5;
+    }
+}
+
+
+void genann_free(genann *ann) {
+#ifdef GENANN_MMAP
+    if (ann && ann->mapping) munmap(ann->mapping, ann->mapping_size);
+#endif
+
+    /* The weight, output, and delta pointers go to the same buffer. */
+    if (ann && ann->arena) genann_arena_release(ann->arena, ann);
+    else free(ann);
+}
+
+
+/* Returns the width of the widest layer. */
+static int genann_widest(genann const *ann) {
+    int l, widest = 0;
+    for (l = 0; l <= ann->layers; ++l) {
+        if (ann->layer_size[l] > widest) widest = ann->layer_size[l];
+    }
+    return widest;
+}
+
+
+/* Creates a workspace with room for batch scratch values after the
+ * outputs and deltas. */
+static genann_workspace *genann_workspace_alloc(genann const *ann, size_t batch) {
+    const int neurons = ann->total_neurons - ann->inputs;
+
+    /* Allocate extra size for outputs, deltas and batch scratch. */
+    const size_t size = sizeof(genann_workspace) + sizeof(genann_real) * (2 * (size_t)neurons + batch);
+    genann_workspace *ws = malloc(size);
+    if (!ws) return 0;
+
+    ws->neurons = neurons;
+
+    /* Set pointers. */
+    ws->output = (genann_real*)((char*)ws + sizeof(genann_workspace));
+    ws->delta = ws->output + neurons;
+    ws->batch = batch ? ws->delta + neurons : 0;
+
+    return ws;
+}
+
+
+genann_workspace *genann_workspace_init(genann const *ann) {
+    return genann_workspace_alloc(ann, 0);
+}
+
+
+genann_workspace *genann_workspace_init_batch(genann const *ann) {
+    return genann_workspace_alloc(ann, 2 * (size_t)GENANN_BATCH_SAMPLES * genann_widest(ann));
+}
+
+
+void genann_workspace_free(genann_workspace *ws) {
+    /* The output and delta pointers go to the same buffer. */
+    free(ws);
+}
+
+
+void genann_run_layer(genann const *ann, int layer, genann_real const *inputs, genann_real *o, int first, int last) {
+    const genann_activation act = genann_layer_activation(ann, layer);
+    const int nin = ann->layer_size[layer-1];
+    genann_real const *w = ann->weight + ann->weight_offset[layer] + (size_t)first * (nin + 1);
+    int j;
+    GENANN_STAT_START(start);
+
+    for (j = first; j < last; ++j) {
+        genann_real sum = *w++ * -1.0;
+        sum += genann_dot(w, inputs, nin);
+        w += nin;
+        o[j] = sum;
+    }
+
+    /* Counted per slice, so a layer split across threads adds up to the
+     * whole layer. */
+    GENANN_STAT_CYCLES(forward_cycles, layer, start);
+    GENANN_STAT_START(act_start);
+    genann_activate(ann, &act, o + first, last - first);
+    GENANN_STAT_CYCLES(activation_cycles, layer, act_start);
+    GENANN_STAT_ADD(flops, 2LL * (last - first) * (nin + 1));
+    GENANN_STAT_ADD(bytes, sizeof(genann_real) * (last - first) * (nin + 1));
+}
+
+
+/* Runs the network forward, reading the inputs in place. Each hidden and
+ * output neuron's output is written to o (total_neurons - inputs long). */
+static genann_real const *genann_forward(genann const *ann, genann_real const *inputs, genann_real *o) {
+    genann_real const *i = inputs;
+    genann_real *const first = o;
+
+    int l;
+
+    for (l = 1; l <= ann->layers; ++l) {
+        const int nout = ann->layer_size[l];
+
+        genann_run_layer(ann, l, i, o, 0, nout);
+
+        /* This layer is the next one's input. */
+        i = o;
+        o += nout;
+    }
+
+    /* Sanity check that we wrote all outputs. */
+    assert(o - first == ann->total_neurons - ann->inputs);
+
+    return o - ann->outputs;
+}
+
+
+genann_real const *genann_run(genann const *ann, genann_real const *inputs) {
+    /* Copy the inputs to the scratch area, where we also store each neuron's
+     * output, so callers can find the whole network state in ann->output. */
+    memcpy(ann->output, inputs, sizeof(genann_real) * ann->inputs);
+
+    GENANN_STAT_ADD(run_calls, 1);
+    return genann_forward(ann, ann->output, ann->output + ann->inputs);
+}
+
+
+genann_real const *genann_run_ws(genann const *ann, genann_workspace *ws, genann_real const *inputs) {
+    GENANN_STAT_ADD(run_calls, 1);
+    return genann_forward(ann, inputs, ws->output);
+}
+
+
+/* Computes one layer for a block of b samples. Inputs and outputs are stored
+ * neuron-major (x[k*b + s] is input k of sample s) so the innermost loop runs
+ * over samples with a single weight held in a register. Each sample's sum is
+ * accumulated in input order. genann_run's vector dot product splits its
+ * sum across lanes, so the two agree only to within rounding error unless
+ * built with GENANN_NO_SIMD. */
+static void genann_layer_batch(genann_real const *w, int nin, int nout,
+        genann_real const *x, genann_real *y, int b, genann_activation const *act, genann const *ann) {
+    const int stride = nin + 1;
+    int j, kk, s;
+
+    for (kk = 0; kk < nin; kk += GENANN_BATCH_INPUTS) {
+        const int kend = kk + GENANN_BATCH_INPUTS < nin ? kk + GENANN_BATCH_INPUTS : nin;
+
+        for (j = 0; j < nout; ++j) {
+            genann_real const *wj = w + j * stride;
+            genann_real *yj = y + j * b;
+
+            if (kk == 0) {
+                const genann_real bias = wj[0] * -1.0;
+                for (s = 0; s < b; ++s) yj[s] = bias;
+            }
+
+            genann_row_block(wj + 1 + kk, x + kk * b, yj, kend - kk, b);
+        }
+    }
+
+    genann_activate(ann, act, y, nout * b);
+}
+
+
+/* Does genann_run_batch with scratch, which is 2 * GENANN_BATCH_SAMPLES
+ * values of the widest layer long. */
+static void genann_run_batch_in(genann const *ann, genann_real *scratch, genann_real const *inputs, int n, genann_real *outputs) {
+    const int widest = genann_widest(ann);
+    int base, l, j, s;
+
+    for (base = 0; base < n; base += GENANN_BATCH_SAMPLES) {
+        const int b = n - base < GENANN_BATCH_SAMPLES ? n - base : GENANN_BATCH_SAMPLES;
+        genann_real *x = scratch;
+        genann_real *y = scratch + GENANN_BATCH_SAMPLES * widest;
+
+        /* Transpose the block of samples into neuron-major order. */
+        for (s = 0; s < b; ++s) {
+            genann_real const *in = inputs + (long long)(base + s) * ann->inputs;
+            for (j = 0; j < ann->inputs; ++j) x[j * b + s] = in[j];
+        }
+
+        for (l = 1; l <= ann->layers; ++l) {
+            const genann_activation act = genann_layer_activation(ann, l);
+
+            genann_layer_batch(ann->weight + ann->weight_offset[l], ann->layer_size[l-1], ann->layer_size[l],
+                    x, y, b, &act, ann);
+
+            genann_real *t = x; x = y; y = t;
+        }
+
+        for (s = 0; s < b; ++s) {
+            genann_real *out = outputs + (long long)(base + s) * ann->outputs;
+            for (j = 0; j < ann->outputs; ++j) out[j] = x[j * b + s];
+        }
+    }
+}
+
+
+int genann_run_batch(genann const *ann, genann_real const *inputs, int n, genann_real *outputs) {
+    genann_real *scratch = malloc(sizeof(genann_real) * 2 * GENANN_BATCH_SAMPLES * genann_widest(ann));
+    if (!scratch) return -1;
+
+    genann_run_batch_in(ann, scratch, inputs, n, outputs);
+
+    free(scratch);
+    return 0;
+}
+
+
+int genann_run_batch_ws(genann const *ann, genann_workspace *ws, genann_real const *inputs, int n, genann_real *outputs) {
+    if (!ws->batch) return -1;
+    genann_run_batch_in(ann, ws->batch, inputs, n, outputs);
+    return 0;
+}
+
+
+/* Backpropagates from a completed forward pass and updates the weights.
+ * Here o holds the hidden and output neuron outputs, as written by
+ * genann_forward, and d receives the matching deltas. */
+static void genann_backward(genann const *ann, genann_real const *inputs, genann_real const *o, genann_real *d,
+        genann_real const *desired_outputs, double learning_rate) {
+    const int L = ann->layers;
+    int l, j, k;
+
+    /* First set the output layer deltas. */
+    {
+        GENANN_STAT_START(start);
+        const genann_activation act = genann_layer_activation(ann, L);
+        genann_real const *oo = o + ann->neuron_offset[L] - ann->inputs; /* First output. */
+        genann_real *dd = d + ann->neuron_offset[L] - ann->inputs; /* First delta. */
+        genann_real const *t = desired_outputs; /* First desired output. */
+
+
+        /* Set output layer deltas. */
+        for (j = 0; j < ann->outputs; ++j) {
+            dd[j] = t[j] - oo[j];
+        }
+        GENANN_STAT_CYCLES(backward_cycles, L, start);
+
+        GENANN_STAT_START(act_start);
+        genann_activate_derivative(ann, &act, oo, dd, ann->outputs);
+        GENANN_STAT_CYCLES(activation_cycles, L, act_start);
+    }
+
+
+    /* Set hidden layer deltas, start on last layer and work backwards. */
+    /* Note that loop is skipped in the case of hidden_layers == 0. */
+    for (l = L - 1; l >= 1; --l) {
+        const genann_activation act = genann_layer_activation(ann, l);
+        const int n = ann->layer_size[l];
+        const int nnext = ann->layer_size[l+1];
+        GENANN_STAT_START(start);
+
+        /* Find first output and delta in this layer. */
+        genann_real const *oo = o + ann->neuron_offset[l] - ann->inputs;
+        genann_real *dh = d + ann->neuron_offset[l] - ann->inputs;
+
+        /* Find first delta in following layer (which may be hidden or output). */
+        genann_real const * const dd = d + ann->neuron_offset[l+1] - ann->inputs;
+
+        /* Find first weight in following layer (which may be hidden or output). */
+        genann_real const * const ww = ann->weight + ann->weight_offset[l+1];
+
+        /* Walk the following layer's weights row by row, adding each of its
+         * deltas back along that neuron's weights (skipping its bias). Each
+         * dh[j] still sums over k in order, but the weights are read in the
+         * order they are stored rather than one column at a time. */
+        for (j = 0; j < n; ++j) dh[j] = 0;
+
+        for (k = 0; k < nnext; ++k) {
+            genann_axpy(dh, dd[k], ww + k * (n + 1) + 1, n);
+        }
+
+        GENANN_STAT_CYCLES(backward_cycles, l, start);
+        GENANN_STAT_ADD(flops, 2LL * n * nnext);
+        GENANN_STAT_ADD(bytes, sizeof(genann_real) * n * nnext);
+
+        GENANN_STAT_START(act_start);
+        genann_activate_derivative(ann, &act, oo, dh, n);
+        GENANN_STAT_CYCLES(activation_cycles, l, act_start);
+    }
+
+
+    /* Train the layers, outputs first. */
+    for (l = L; l >= 1; --l) {
+        GENANN_STAT_START(start);
+
+        /* Find first delta in this layer. */
+        genann_real const *dd = d + ann->neuron_offset[l] - ann->inputs;
+
+        /* Find first input to this layer. */
+        genann_real const *i = l > 1
+                ? o + ann->neuron_offset[l-1] - ann->inputs
+                : inputs;
+
+        /* Find first weight to this layer. */
+        genann_real *w = ann->weight + ann->weight_offset[l];
+
+        const int n = ann->layer_size[l-1];
+        for (j = 0; j < ann->layer_size[l]; ++j) {
+            *w++ += *dd * learning_rate * -1.0;
+            genann_axpy(w, *dd * learning_rate, i, n);
+            w += n;
+            ++dd;
+        }
+
+        assert(l < L || w - ann->weight == ann->total_weights);
+
+        /* Each weight is read and written once. */
+        GENANN_STAT_CYCLES(update_cycles, l, start);
+        GENANN_STAT_ADD(flops, 2LL * ann->layer_size[l] * (n + 1));
+        GENANN_STAT_ADD(bytes, 2 * sizeof(genann_real) * ann->layer_size[l] * (n + 1));
+    }
+
+}
+
+
+/* Returns the sum of (t[j] - o[j])^2 for j < n. */
+static double genann_sse(genann_real const *o, genann_real const *t, int n) {
+    double sum = 0;
+    int j;
+    for (j = 0; j < n; ++j) {
+        const double e = t[j] - o[j];
+        sum += e * e;
+    }
+    return sum;
+}
+
+
+void genann_train(genann const *ann, genann_real const *inputs, genann_real const *desired_outputs, double learning_rate) {
+    genann_train_ex(ann, inputs, desired_outputs, learning_rate);
+}
+
+
+double genann_train_ex(genann const *ann, genann_real const *inputs, genann_real const *desired_outputs, double learning_rate) {
+    /* To begin with, we must run the network forward, as genann_run does. */
+    memcpy(ann->output, inputs, sizeof(genann_real) * ann->inputs);
+    genann_forward(ann, ann->output, ann->output + ann->inputs);
+
+    return genann_backprop_from_last_run(ann, desired_outputs, learning_rate);
+}
+
+
+double genann_backprop_from_last_run(genann const *ann, genann_real const *desired_outputs, double learning_rate) {
+    /* genann_run left the inputs and every neuron's output in ann->output. */
+    const double loss = genann_sse(ann->output + ann->total_neurons - ann->outputs, desired_outputs, ann->outputs);
+
+    GENANN_STAT_ADD(train_calls, 1);
+    genann_backward(ann, ann->output, ann->output + ann->inputs, ann->delta,
+            desired_outputs, learning_rate);
+
+    return loss;
+}
+
+
+void genann_train_ws(genann const *ann, genann_workspace *ws, genann_real const *inputs, genann_real const *desired_outputs, double learning_rate) {
+    genann_forward(ann, inputs, ws->output);
+
+    GENANN_STAT_ADD(train_calls, 1);
+    genann_backward(ann, inputs, ws->output, ws->delta, desired_outputs, learning_rate);
+}
+
+
+int genann_stats_snapshot(genann_stats *out) {
+#ifdef GENANN_STATS
+    unsigned long long *dst = (unsigned long long *)out;
+    unsigned long long *src = (unsigned long long *)&stats;
+    size_t k;
+
+    /* Every field is a counter, so copy them one by one; each is whole
+     * even while other threads are counting. */
+    for (k = 0; k < sizeof(stats) / sizeof(*src); ++k) {
+#ifdef __GNUC__
+        dst[k] = __atomic_load_n(src + k, __ATOMIC_RELAXED);
+#else
+        dst[k] = src[k];
+#endif
+    }
+    return 0;
+#else
+    memset(out, 0, sizeof(*out));
+    return -1;
+#endif
+}
+
+
+void genann_stats_count_run(void) {
+    GENANN_STAT_ADD(run_calls, 1);
+}
+
+
+void genann_stats_reset(void) {
+#ifdef GENANN_STATS
+    unsigned long long *src = (unsigned long long *)&stats;
+    size_t k;
+    for (k = 0; k < sizeof(stats) / sizeof(*src); ++k) {
+#ifdef __GNUC__
+        __atomic_store_n(src + k, 0, __ATOMIC_RELAXED);
+#else
+        src[k] = 0;
+#endif
+    }
+#endif
+}
+
+
+int genann_gradient(genann const *ann, genann_real const *inputs, genann_real const *desired_outputs, int n, genann_real *grad) {
+    const int L = ann->layers;
+    const int B = GENANN_BATCH_SAMPLES;
+    const int widest = genann_widest(ann);
+
+    /* Every layer's outputs and deltas for one block, neuron-major, plus
+     * room for one layer's inputs transposed. */
+    genann_real *a = malloc(sizeof(genann_real) * B * (ann->total_neurons + (ann->total_neurons - ann->inputs) + widest));
+    if (!a) return -1;
+    genann_real *delta = a + B * ann->total_neurons;
+    genann_real *xt = delta + B * (ann->total_neurons - ann->inputs);
+
+    int base, l, j, k, s;
+
+    for (base = 0; base < n; base += B) {
+        const int b = n - base < B ? n - base : B;
+
+        /* Layer l's outputs and deltas for this block. */
+#define OUT(l) (a + ann->neuron_offset[l] * b)
+#define DELTA(l) (delta + (ann->neuron_offset[l] - ann->inputs) * b)
+
+        for (s = 0; s < b; ++s) {
+            genann_real const *in = inputs + (long long)(base + s) * ann->inputs;
+            for (j = 0; j < ann->inputs; ++j) a[j * b + s] = in[j];
+        }
+
+        /* Forward pass, keeping every layer. */
+        for (l = 1; l <= L; ++l) {
+            const genann_activation act = genann_layer_activation(ann, l);
+            genann_layer_batch(ann->weight + ann->weight_offset[l], ann->layer_size[l-1], ann->layer_size[l],
+                    OUT(l-1), OUT(l), b, &act, ann);
+        }
+
+        /* Output layer deltas. */
+        {
+            const genann_activation act = genann_layer_activation(ann, L);
+            genann_real const *o = OUT(L);
+            genann_real *d = DELTA(L);
+
+            for (j = 0; j < ann->outputs; ++j) {
+                for (s = 0; s < b; ++s) {
+                    const genann_real t = desired_outputs[(long long)(base + s) * ann->outputs + j];
+                    d[j * b + s] = t - o[j * b + s];
+                }
+            }
+            genann_activate_derivative(ann, &act, o, d, ann->outputs * b);
+        }
+
+        /* Hidden layer deltas, working backwards. The following layer's
+         * weights are walked row by row, scattering each of its deltas back
+         * into this layer. */
+        for (l = L - 1; l >= 1; --l) {
+            const genann_activation act = genann_layer_activation(ann, l);
+            const int nl = ann->layer_size[l];
+            const int nnext = ann->layer_size[l+1];
+            genann_real *d = DELTA(l);
+            genann_real const *dd = DELTA(l+1);
+            genann_real const *ww = ann->weight + ann->weight_offset[l+1];
+
+            for (j = 0; j < nl * b; ++j) d[j] = 0;
+
+            for (k = 0; k < nnext; ++k) {
+                genann_scatter_block(ww + k * (nl + 1) + 1, dd + k * b, d, nl, b);
+            }
+
+            genann_activate_derivative(ann, &act, OUT(l), d, nl * b);
+        }
+
+        /* Accumulate the gradient, one weight row at a time. Each layer's
+         * inputs are first turned back to sample-major order so every
+         * sample adds a contiguous row. */
+        for (l = 1; l <= L; ++l) {
+            const int nin = ann->layer_size[l-1];
+            genann_real const *x = OUT(l-1);
+            genann_real const *d = DELTA(l);
+            genann_real *g = grad + ann->weight_offset[l];
+
+            for (k = 0; k < nin; ++k) {
+                for (s = 0; s < b; ++s) xt[s * nin + k] = x[k * b + s];
+            }
+
+            for (j = 0; j < ann->layer_size[l]; ++j) {
+                genann_real const *dj = d + j * b;
+                for (s = 0; s < b; ++s) {
+                    g[0] += dj[s];
+                    genann_axpy(g + 1, -dj[s], xt + s * nin, nin);
+                }
+                g += nin + 1;
+            }
+        }
+
+#undef OUT
+#undef DELTA
+    }
+
+    free(a);
+    return 0;
+}
+
+
+int genann_train_batch(genann const *ann, genann_real const *inputs, genann_real const *desired_outputs, int n, double learning_rate) {
+    if (n < 1) return 0;
+
+    genann_real *grad = calloc(ann->total_weights, sizeof(genann_real));
+    if (!grad) return -1;
+
+    if (genann_gradient(ann, inputs, desired_outputs, n, grad)) {
+        free(grad);
+        return -1;
+    }
+
+    /* A single pass writes every weight once for the whole batch. This is
+     * deliberately not genann_axpy, which may fuse the multiply-add, so that
+     * genann_train_batch_mt on one thread gives the very same weights. */
+    const genann_real rate = learning_rate / n;
+    int i;
+    for (i = 0; i < ann->total_weights; ++i) {
+        ann->weight[i] -= rate * grad[i];
+    }
+
+    free(grad);
+    return 0;
+}
+
+
+genann_optimizer *genann_optimizer_init(genann const *ann, int type, double learning_rate) {
+    int moments;
+    switch (type) {
+        case GENANN_OPT_SGD: moments = 0; break;
+        case GENANN_OPT_MOMENTUM:
+        case GENANN_OPT_NESTEROV:
+        case GENANN_OPT_RMSPROP: moments = 1; break;
+        case GENANN_OPT_ADAM: moments = 2; break;
+        default: return 0;
+    }
+
+    /* Allocate extra size for the moments and a gradient, each laid out
+     * like the weights, so an update streams through all of them once. */
+    const size_t size = sizeof(genann_optimizer) + sizeof(genann_real) * (moments + 1) * (size_t)ann->total_weights;
+    genann_optimizer *opt = malloc(size);
+    if (!opt) return 0;
+
+    opt->type = type;
+    opt->learning_rate = learning_rate;
+    opt->beta1 = .9;
+    opt->beta2 = type == GENANN_OPT_RMSPROP ? .9 : .999;
+    opt->epsilon = 1e-8;
+    opt->weight_decay = 0;
+    opt->total_weights = ann->total_weights;
+
+    /* Set pointers. */
+    opt->grad = (genann_real*)((char*)opt + sizeof(genann_optimizer));
+    opt->m = moments > 0 ? opt->grad + ann->total_weights : 0;
+    opt->v = moments > 1 ? opt->m + ann->total_weights : 0;
+
+    genann_optimizer_reset(opt);
+
+    return opt;
+}
+
+
+void genann_optimizer_reset(genann_optimizer *opt) {
+    opt->steps = 0;
+    if (opt->m) memset(opt->m, 0, sizeof(genann_real) * opt->total_weights);
+    if (opt->v) memset(opt->v, 0, sizeof(genann_real) * opt->total_weights);
+}
+
+
+void genann_optimizer_free(genann_optimizer *opt) {
+    /* The moments and gradient go to the same buffer. */
+    free(opt);
+}
+
+
+/* The update of each optimizer, fused into one pass over n weights. Here g
+ * is the summed gradient and scale turns it into the mean; keep is what
+ * weight decay leaves of each weight. */
+GENANN_KERNEL
+static void genann_step_sgd(genann_real *w, genann_real const *g, int n,
+        genann_real scale, genann_real rate, genann_real keep) {
+    int i;
+    for (i = 0; i < n; ++i) {
+        w[i] = w[i] * keep - rate * (g[i] * scale);
+    }
+}
+
+GENANN_KERNEL
+static void genann_step_momentum(genann_real *w, genann_real const *g, genann_real *m, int n,
+        genann_real scale, genann_real rate, genann_real keep, genann_real mu, int nesterov) {
+    int i;
+    for (i = 0; i < n; ++i) {
+        const genann_real gi = g[i] * scale;
+        m[i] = mu * m[i] + gi;
+        w[i] = w[i] * keep - rate * (nesterov ? gi + mu * m[i] : m[i]);
+    }
+}
+
+GENANN_KERNEL
+static void genann_step_rmsprop(genann_real *w, genann_real const *g, genann_real *v, int n,
+        genann_real scale, genann_real rate, genann_real keep, genann_real rho, genann_real eps) {
+    int i;
+    for (i = 0; i < n; ++i) {
+        const genann_real gi = g[i] * scale;
+        v[i] = rho * v[i] + (1 - rho) * gi * gi;
+        w[i] = w[i] * keep - rate * gi / (sqrt(v[i]) + eps);
+    }
+}
+
+GENANN_KERNEL
+static void genann_step_adam(genann_real *w, genann_real const *g, genann_real *m, genann_real *v, int n,
+        genann_real scale, genann_real rate, genann_real keep, genann_real b1, genann_real b2,
+        genann_real c1, genann_real c2, genann_real eps) {
+    int i;
+    for (i = 0; i < n; ++i) {
+        const genann_real gi = g[i] * scale;
+        m[i] = b1 * m[i] + (1 - b1) * gi;
+        v[i] = b2 * v[i] + (1 - b2) * gi * gi;
+        w[i] = w[i] * keep - rate * (m[i] * c1) / (sqrt(v[i] * c2) + eps);
+    }
+}
+
+
+int genann_optimizer_step(genann_optimizer *opt, genann const *ann, genann_real const *grad, int n) {
+    assert(opt->total_weights == ann->total_weights);
+
+    /* The gradient is averaged over n samples. */
+    if (n < 1) return -1;
+
+    const genann_real scale = 1.0 / n;
+    const genann_real rate = opt->learning_rate;
+    const genann_real keep = 1.0 - opt->learning_rate * opt->weight_decay;
+    genann_real *w = ann->weight;
+    const int count = ann->total_weights;
+
+    ++opt->steps;
+
+    switch (opt->type) {
+        case GENANN_OPT_SGD:
+            genann_step_sgd(w, grad, count, scale, rate, keep);
+            break;
+        case GENANN_OPT_MOMENTUM:
+        case GENANN_OPT_NESTEROV:
+            genann_step_momentum(w, grad, opt->m, count, scale, rate, keep, opt->beta1,
+                    opt->type == GENANN_OPT_NESTEROV);
+            break;
+        case GENANN_OPT_RMSPROP:
+            genann_step_rmsprop(w, grad, opt->m, count, scale, rate, keep, opt->beta2, opt->epsilon);
+            break;
+        case GENANN_OPT_ADAM: {
+            /* Bias corrections for the zero-initialized moments. */
+            const genann_real c1 = 1.0 / (1.0 - pow(opt->beta1, (double)opt->steps));
+            const genann_real c2 = 1.0 / (1.0 - pow(opt->beta2, (double)opt->steps));
+            genann_step_adam(w, grad, opt->m, opt->v, count, scale, rate, keep,
+                    opt->beta1, opt->beta2, c1, c2, opt->epsilon);
+            break;
+        }
+    }
+
+    return 0;
+}
+
+
+int genann_train_opt(genann const *ann, genann_optimizer *opt, genann_real const *inputs, genann_real const *desired_outputs, int n) {
+    if (n < 1) return 0;
+
+    memset(opt->grad, 0, sizeof(genann_real) * ann->total_weights);
+    if (genann_gradient(ann, inputs, desired_outputs, n, opt->grad)) return -1;
+
+    genann_optimizer_step(opt, ann, opt->grad, n);
+    return 0;
+}
+
+
+void genann_write(genann const *ann, FILE *out) {
+    if (genann_uniform(ann)) {
+        fprintf(out, "%d %d %d %d", ann->inputs, ann->hidden_layers, ann->hidden, ann->outputs);
+    } else {
+        /* A negative count, which older versions reject, then the widths. */
+        int l;
+        fprintf(out, "%d", -(ann->layers + 1));
+        for (l = 0; l <= ann->layers; ++l) fprintf(out, " %d", ann->layer_size[l]);
+    }
+
+    int i;
+    for (i = 0; i < ann->total_weights; ++i) {
+        fprintf(out, " %.20e", (double)ann->weight[i]);
+    }
+}
+
+
+/* Writes v as a literal of the exported type. */
+static void genann_export_real(FILE *out, double v) {
+    if (sizeof(genann_real) < sizeof(double)) fprintf(out, "%.9ef", v);
+    else fprintf(out, "%.17e", v);
+}
+
+
+/* Writes the statement applying activation id to x[j]. Both sigmoids come
+ * out as the exact sigmoid, which needs no table. */
+static int genann_export_activation(FILE *out, int id, const char *x) {
+    const char *f = sizeof(genann_real) < sizeof(double) ? "f" : "";
+
+    switch (id) {
+        case GENANN_ACT_SIGMOID_CACHED:
+        case GENANN_ACT_SIGMOID:
+            fprintf(out, "        %s[j] = %s[j] < -45 ? 0 : %s[j] > 45 ? 1 : 1 / (1 + exp%s(-%s[j]));\n", x, x, x, f, x);
+            return 0;
+        case GENANN_ACT_THRESHOLD:
+            fprintf(out, "        %s[j] = %s[j] > 0;\n", x, x);
+            return 0;
+        case GENANN_ACT_LINEAR:
+            return 0;
+        case GENANN_ACT_TANH:
+            fprintf(out, "        %s[j] = tanh%s(%s[j]);\n", x, f, x);
+            return 0;
+        case GENANN_ACT_RELU:
+            fprintf(out, "        %s[j] = %s[j] > 0 ? %s[j] : 0;\n", x, x, x);
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+
+int genann_export_c(genann const *ann, FILE *out, const char *name) {
+    const char *type = sizeof(genann_real) < sizeof(double) ? "float" : "double";
+    int l, j, k, i;
+
+    if (!name || !(isalpha((unsigned char)*name) || *name == '_')) return -1;
+    for (i = 1; name[i]; ++i) {
+        if (!isalnum((unsigned char)name[i]) && name[i] != '_') return -1;
+    }
+
+    for (l = 1; l <= ann->layers; ++l) {
+        const int id = genann_layer_activation(ann, l).id;
+        if (id < 0 || id >= GENANN_BUILTIN_ACTIVATIONS) return -1;
+    }
+    for (i = 0; i < ann->total_weights; ++i) {
+        if (!isfinite(ann->weight[i])) return -1;
+    }
+
+    fprintf(out, "/* %s: generated by genann_export_c from an ann with layers", name);
+    for (l = 0; l <= ann->layers; ++l) fprintf(out, " %d", ann->layer_size[l]);
+    fprintf(out, ". */\n\n#include <math.h>\n\n");
+    fprintf(out, "#define %s_inputs %d\n#define %s_outputs %d\n\n", name, ann->inputs, name, ann->outputs);
+
+    /* Large layers get their weights transposed, one row per input, so
+     * that each input adds into every neuron of the layer: a loop the
+     * compiler vectorizes without reordering any sum. */
+    for (l = 1; l <= ann->layers; ++l) {
+        const int nin = ann->layer_size[l-1], nout = ann->layer_size[l];
+        genann_real const *w = ann->weight + ann->weight_offset[l];
+        if ((long long)nout * (nin + 1) <= GENANN_EXPORT_UNROLL) continue;
+
+        fprintf(out, "static const %s %s_bias%d[%d] = {", type, name, l, nout);
+        for (j = 0; j < nout; ++j) {
+            fprintf(out, j % 4 ? " " : "\n    ");
+            genann_export_real(out, -w[(size_t)j * (nin + 1)]);
+            fprintf(out, ",");
+        }
+        fprintf(out, "\n};\n\n");
+
+        fprintf(out, "static const %s %s_weight%d[%d][%d] = {\n", type, name, l, nin, nout);
+        for (k = 0; k < nin; ++k) {
+            fprintf(out, "    {");
+            for (j = 0; j < nout; ++j) {
+                fprintf(out, j % 4 ? " " : "\n        ");
+                genann_export_real(out, w[(size_t)j * (nin + 1) + k + 1]);
+                fprintf(out, ",");
+            }
+            fprintf(out, "\n    },\n");
+        }
+        fprintf(out, "};\n\n");
+    }
+
+    fprintf(out, "void %s(%s const *inputs, %s *outputs) {\n", name, type, type);
+    for (l = 1; l < ann->layers; ++l) fprintf(out, "    %s h%d[%d];\n", type, l, ann->layer_size[l]);
+
+    /* Declare only the counters in use, so the output compiles cleanly. */
+    int loops = 0, activations = 0;
+    for (l = 1; l <= ann->layers; ++l) {
+        if ((long long)ann->layer_size[l] * (ann->layer_size[l-1] + 1) > GENANN_EXPORT_UNROLL) loops = 1;
+        if (genann_layer_activation(ann, l).id != GENANN_ACT_LINEAR) activations = 1;
+    }
+    if (loops) fprintf(out, "    int j, k;\n");
+    else if (activations) fprintf(out, "    int j;\n");
+
+    for (l = 1; l <= ann->layers; ++l) {
+        const int nin = ann->layer_size[l-1], nout = ann->layer_size[l];
+        genann_real const *w = ann->weight + ann->weight_offset[l];
+        char x[32], o[32];
+
+        if (l == 1) strcpy(x, "inputs");
+        else sprintf(x, "h%d", l - 1);
+        if (l == ann->layers) strcpy(o, "outputs");
+        else sprintf(o, "h%d", l);
+
+        fprintf(out, "\n");
+        if ((long long)nout * (nin + 1) <= GENANN_EXPORT_UNROLL) {
+            for (j = 0; j < nout; ++j, w += nin + 1) {
+                fprintf(out, "    %s[%d] = ", o, j);
+                genann_export_real(out, -w[0]);
+                for (k = 0; k < nin; ++k) {
+                    fprintf(out, "\n        + ");
+                    genann_export_real(out, w[k+1]);
+                    fprintf(out, " * %s[%d]", x, k);
+                }
+                fprintf(out, ";\n");
+            }
+        } else {
+            fprintf(out, "    for (j = 0; j < %d; ++j) %s[j] = %s_bias%d[j];\n", nout, o, name, l);
+            fprintf(out, "    for (k = 0; k < %d; ++k) {\n", nin);
+            fprintf(out, "        for (j = 0; j < %d; ++j) %s[j] += %s_weight%d[k][j] * %s[k];\n", nout, o, name, l, x);
+            fprintf(out, "    }\n");
+        }
+
+        if (genann_layer_activation(ann, l).id != GENANN_ACT_LINEAR) {
+            fprintf(out, "    for (j = 0; j < %d; ++j) {\n", nout);
+            genann_export_activation(out, genann_layer_activation(ann, l).id, o);
+            fprintf(out, "    }\n");
+        }
+    }
+
+    fprintf(out, "}\n");
+
+    return ferror(out) ? -1 : 0;
+}
+
+
+/* Layout of the header written by genann_write_binary. All fields are
+ * little-endian; the weights follow at GENANN_BINARY_HEADER, which keeps
+ * them aligned for any genann_real.
+ *
+ * Version 2 files, written for layers of differing widths or activations,
+ * have a table of two 32-bit values per layer between the header and the
+ * weights: the layer's width and its activation id. The checksum then
+ * covers the table too.
+ *
+ * Version 3 files, written by genann_sparse_write, always have the table.
+ * It is followed by each neuron's number of connections and the index of
+ * each connection, as 32-bit values, then the biases and the connection
+ * weights. The total weights field holds the number of connections. */
+#define GENANN_BINARY_MAGIC "GENANNB\0"
+#define GENANN_BINARY_VERSION 1
+#define GENANN_BINARY_VERSION_LAYERS 2
+#define GENANN_BINARY_VERSION_SPARSE 3
+#define GENANN_BINARY_BOM 0x01020304u
+#define GENANN_BINARY_HEADER 64
+
+enum {
+    GENANN_BH_VERSION = 8,
+    GENANN_BH_BOM = 12,
+    GENANN_BH_REAL = 16,
+    GENANN_BH_INPUTS = 20,
+    GENANN_BH_HIDDEN_LAYERS = 24,
+    GENANN_BH_HIDDEN = 28,
+    GENANN_BH_OUTPUTS = 32,
+    GENANN_BH_ACT_HIDDEN = 36,
+    GENANN_BH_ACT_OUTPUT = 40,
+    GENANN_BH_TOTAL_WEIGHTS = 44,
+    GENANN_BH_CHECKSUM = 48
+};
+
+/* Returns the id under which an activation is saved, or GENANN_ACT_CUSTOM. */
+static int genann_act_id(genann_actfun act, genann_activation const *desc) {
+    return genann_find_activation(act, desc).id;
+}
+
+
+static int genann_little_endian(void) {
+    const uint32_t one = 1;
+    unsigned char c;
+    memcpy(&c, &one, 1);
+    return c == 1;
+}
+
+
+static void genann_put32(unsigned char *p, uint32_t v) {
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+
+static uint32_t genann_get32(unsigned char const *p) {
+    return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+
+/* Reverses the bytes of each of n values of the given size. */
+static void genann_swap_bytes(void *data, size_t n, size_t size) {
+    unsigned char *p = data;
+    size_t i, j;
+    for (i = 0; i < n; ++i, p += size) {
+        for (j = 0; j < size / 2; ++j) {
+            const unsigned char t = p[j];
+            p[j] = p[size - 1 - j];
+            p[size - 1 - j] = t;
+        }
+    }
+}
+
+
+/* FNV-1a, taken over little-endian 64-bit words rather than single bytes
+ * so it keeps up with fread. Any tail shorter than a word is zero padded.
+ * Start with h = GENANN_CHECKSUM_INIT, or continue from an earlier result. */
+#define GENANN_CHECKSUM_INIT 14695981039346656037ull
+
+static uint64_t genann_checksum(uint64_t h, void const *data, size_t size) {
+    unsigned char const *p = data;
+
+    while (size) {
+        unsigned char b[8] = {0};
+        const size_t n = size < 8 ? size : 8;
+        memcpy(b, p, n);
+
+        uint64_t word = 0;
+        int i;
+        for (i = 7; i >= 0; --i) word = word << 8 | b[i];
+
+        h = (h ^ word) * 1099511628211ull;
+        p += n;
+        size -= n;
+    }
+
+    return h;
+}
+
+
+/* Returns whether ann needs the layer table of a version 2 file. */
+static int genann_binary_has_layers(genann const *ann) {
+    int l;
+    if (!genann_uniform(ann)) return 1;
+    for (l = 1; l <= ann->layers; ++l) {
+        if (ann->layer_activation[l]) return 1;
+    }
+    return 0;
+}
+
+
+int genann_write_binary(genann const *ann, FILE *out) {
+    const size_t bytes = sizeof(genann_real) * (size_t)ann->total_weights;
+    unsigned char header[GENANN_BINARY_HEADER] = {0};
+    unsigned char *table = 0;
+    size_t table_bytes = 0;
+    genann_real *swapped = 0;
+    void const *data = ann->weight;
+    uint64_t sum = GENANN_CHECKSUM_INIT;
+    int l;
+
+    if (genann_binary_has_layers(ann)) {
+        table_bytes = 8 * (size_t)(ann->layers + 1);
+        table = malloc(table_bytes);
+        if (!table) return -1;
+
+        for (l = 0; l <= ann->layers; ++l) {
+            genann_put32(table + 8 * l, ann->layer_size[l]);
+            genann_put32(table + 8 * l + 4, l ? genann_layer_activation(ann, l).id : GENANN_ACT_CUSTOM);
+        }
+
+        sum = genann_checksum(sum, table, table_bytes);
+    }
+
+    /* Weights are stored little-endian. */
+    if (!genann_little_endian()) {
+        swapped = malloc(bytes);
+        if (!swapped) {
+            free(table);
+            return -1;
+        }
+        memcpy(swapped, ann->weight, bytes);
+        genann_swap_bytes(swapped, ann->total_weights, sizeof(genann_real));
+        data = swapped;
+    }
+
+    sum = genann_checksum(sum, data, bytes);
+
+    memcpy(header, GENANN_BINARY_MAGIC, 8);
+    genann_put32(header + GENANN_BH_VERSION, table ? GENANN_BINARY_VERSION_LAYERS : GENANN_BINARY_VERSION);
+    genann_put32(header + GENANN_BH_BOM, GENANN_BINARY_BOM);
+    genann_put32(header + GENANN_BH_REAL, sizeof(genann_real));
+    genann_put32(header + GENANN_BH_INPUTS, ann->inputs);
+    genann_put32(header + GENANN_BH_HIDDEN_LAYERS, ann->hidden_layers);
+    genann_put32(header + GENANN_BH_HIDDEN, ann->hidden);
+    genann_put32(header + GENANN_BH_OUTPUTS, ann->outputs);
+    genann_put32(header + GENANN_BH_ACT_HIDDEN, genann_act_id(ann->activation_hidden, ann->activation_hidden_desc));
+    genann_put32(header + GENANN_BH_ACT_OUTPUT, genann_act_id(ann->activation_output, ann->activation_output_desc));
+    genann_put32(header + GENANN_BH_TOTAL_WEIGHTS, ann->total_weights);
+    genann_put32(header + GENANN_BH_CHECKSUM, (uint32_t)sum);
+    genann_put32(header + GENANN_BH_CHECKSUM + 4, (uint32_t)(sum >> 32));
+
+    int rc = 0;
+    if (fwrite(header, sizeof(header), 1, out) != 1) rc = -1;
+    if (!rc && table && fwrite(table, table_bytes, 1, out) != 1) rc = -1;
+    if (!rc && bytes && fwrite(data, bytes, 1, out) != 1) rc = -1;
+
+    free(table);
+    free(swapped);
+    return rc;
+}
+
+
+/* Returns the size of the layer table that follows a binary header, which
+ * is 0 for version 1 files, or -1 if the header is not one we can read. */
+static long genann_binary_table_bytes(unsigned char const *header) {
+    if (memcmp(header, GENANN_BINARY_MAGIC, 8) != 0) return -1;
+    if (genann_get32(header + GENANN_BH_BOM) != GENANN_BINARY_BOM) return -1;
+
+    switch (genann_get32(header + GENANN_BH_VERSION)) {
+        case GENANN_BINARY_VERSION: return 0;
+        case GENANN_BINARY_VERSION_LAYERS: {
+            const int32_t hidden_layers = genann_get32(header + GENANN_BH_HIDDEN_LAYERS);
+            if (hidden_layers < 0 || hidden_layers > GENANN_MAX_DIMENSION - 2) return -1;
+            return 8 * (long)(hidden_layers + 2);
+        }
+        default: return -1;
+    }
+}
+
+
+static genann_activation const *genann_builtin_activation(int32_t id, genann_activation const *otherwise) {
+    return id >= 0 && id < GENANN_BUILTIN_ACTIVATIONS ? genann_builtin_activations[id] : otherwise;
+}
+
+
+/* Checks a binary header, and the layer table for version 2 files, and
+ * creates a matching ann, with activations set but weights not yet loaded.
+ * The file's real size is stored in *real. */
+static genann *genann_binary_init(unsigned char const *header, unsigned char const *table, int *real, int with_weights) {
+    if (genann_binary_table_bytes(header) < 0) return 0;
+
+    *real = genann_get32(header + GENANN_BH_REAL);
+    if (*real != sizeof(float) && *real != sizeof(double)) return 0;
+
+    const int32_t hidden_layers = genann_get32(header + GENANN_BH_HIDDEN_LAYERS);
+    genann *ann;
+    int l;
+
+    if (table) {
+        int *sizes = malloc(sizeof(int) * (hidden_layers + 2));
+        if (!sizes) return 0;
+        for (l = 0; l < hidden_layers + 2; ++l) sizes[l] = (int32_t)genann_get32(table + 8 * l);
+        ann = genann_alloc(hidden_layers + 2, sizes, with_weights);
+        free(sizes);
+    } else {
+        ann = genann_alloc_uniform(0,
+                (int32_t)genann_get32(header + GENANN_BH_INPUTS),
+                hidden_layers,
+                (int32_t)genann_get32(header + GENANN_BH_HIDDEN),
+                (int32_t)genann_get32(header + GENANN_BH_OUTPUTS),
+                with_weights);
+    }
+    if (!ann) return 0;
+
+    if ((int32_t)genann_get32(header + GENANN_BH_TOTAL_WEIGHTS) != ann->total_weights
+            || (int32_t)genann_get32(header + GENANN_BH_INPUTS) != ann->inputs
+            || (int32_t)genann_get32(header + GENANN_BH_OUTPUTS) != ann->outputs) {
+        genann_free(ann);
+        return 0;
+    }
+
+    /* Unknown activations were custom functions; leave the default. */
+    const int32_t ah = genann_get32(header + GENANN_BH_ACT_HIDDEN);
+    const int32_t ao = genann_get32(header + GENANN_BH_ACT_OUTPUT);
+    genann_set_activation_hidden(ann, genann_builtin_activation(ah, &genann_activation_sigmoid_cached));
+    genann_set_activation_output(ann, genann_builtin_activation(ao, &genann_activation_sigmoid_cached));
+
+    /* Only layers that differ from the above get their own. */
+    if (table) {
+        for (l = 1; l <= ann->layers; ++l) {
+            const int32_t id = genann_get32(table + 8 * l + 4);
+            if (id != (l == ann->layers ? ao : ah)) {
+                genann_set_activation_layer(ann, l, genann_builtin_activation(id, &genann_activation_sigmoid_cached));
+            }
+        }
+    }
+
+    genann_init_sigmoid_lookup(ann);
+
+    return ann;
+}
+
+
+static uint64_t genann_binary_checksum(unsigned char const *header) {
+    return genann_get32(header + GENANN_BH_CHECKSUM)
+        | (uint64_t)genann_get32(header + GENANN_BH_CHECKSUM + 4) << 32;
+}
+
+
+/* Loads and checks the weights that follow a binary header. The checksum
+ * continues from sum, which covers anything read since the header. */
+static int genann_binary_weights(genann *ann, unsigned char const *header, int real, uint64_t sum, FILE *in) {
+    const size_t n = ann->total_weights;
+    const size_t bytes = real * n;
+
+    if (real == sizeof(genann_real)) {
+        /* The usual case: straight into place. */
+        if (n && fread(ann->weight, bytes, 1, in) != 1) return -1;
+        if (genann_checksum(sum, ann->weight, bytes) != genann_binary_checksum(header)) return -1;
+        if (!genann_little_endian()) genann_swap_bytes(ann->weight, n, real);
+        return 0;
+    }
+
+    /* Saved by a build with the other precision. */
+    void *raw = malloc(bytes);
+    if (!raw) return -1;
+
+    if ((n && fread(raw, bytes, 1, in) != 1)
+            || genann_checksum(sum, raw, bytes) != genann_binary_checksum(header)) {
+        free(raw);
+        return -1;
+    }
+
+    if (!genann_little_endian()) genann_swap_bytes(raw, n, real);
+
+    size_t i;
+    for (i = 0; i < n; ++i) {
+        ann->weight[i] = real == sizeof(float) ? ((float*)raw)[i] : ((double*)raw)[i];
+    }
+
+    free(raw);
+    return 0;
+}
+
+
+genann *genann_read_binary(FILE *in) {
+    unsigned char header[GENANN_BINARY_HEADER];
+    unsigned char *table = 0;
+    uint64_t sum = GENANN_CHECKSUM_INIT;
+    int real;
+
+    if (fread(header, sizeof(header), 1, in) != 1) return NULL;
+
+    const long table_bytes = genann_binary_table_bytes(header);
+    if (table_bytes < 0) return NULL;
+
+    if (table_bytes) {
+        table = malloc(table_bytes);
+        if (!table) return NULL;
+        if (fread(table, table_bytes, 1, in) != 1) {
+            free(table);
+            return NULL;
+        }
+        sum = genann_checksum(sum, table, table_bytes);
+    }
+
+    genann *ann = genann_binary_init(header, table, &real, 1);
+    free(table);
+    if (!ann) return NULL;
+
+    if (genann_binary_weights(ann, header, real, sum, in)) {
+        genann_free(ann);
+        return NULL;
+    }
+
+    return ann;
+}
+
+
+genann *genann_open_mmap(const char *path) {
+#ifdef GENANN_MMAP
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size < GENANN_BINARY_HEADER) {
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    /* The mapped weights are used as they are, so they must already be in
+     * this build's format. */
+    const long table_bytes = genann_binary_table_bytes(map);
+    int real;
+    genann *ann = table_bytes < 0 || st.st_size < GENANN_BINARY_HEADER + table_bytes ? 0
+        : genann_binary_init(map, table_bytes ? (unsigned char*)map + GENANN_BINARY_HEADER : 0, &real, 0);
+    if (!ann || real != sizeof(genann_real) || !genann_little_endian()
+            || st.st_size < GENANN_BINARY_HEADER + table_bytes + (off_t)sizeof(genann_real) * ann->total_weights) {
+        if (ann) genann_free(ann);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    ann->weight = (genann_real*)((char*)map + GENANN_BINARY_HEADER + table_bytes);
+    ann->mapping = map;
+    ann->mapping_size = st.st_size;
+
+    return ann;
+#else
+    (void)path;
+    return NULL;
+#endif
+}
+
+
+/* Quantizes n values to int8 with a common scale, which is returned. */
+static genann_real genann_q8_pack(genann_real const *x, int n, signed char *q) {
+    genann_real max = 0;
+    int k;
+
+    for (k = 0; k < n; ++k) {
+        const genann_real m = fabs(x[k]);
+        if (m > max) max = m;
+    }
+
+    if (max == 0) {
+        memset(q, 0, n);
+        return 0;
+    }
+
+    const genann_real inv = 127 / max;
+    for (k = 0; k < n; ++k) {
+        q[k] = (signed char)lrint(x[k] * inv);
+    }
+
+    return max / 127;
+}
+
+
+genann_q8 *genann_quantize(genann const *ann) {
+    const int neurons = ann->total_neurons - ann->inputs;
+    const int qweights = ann->total_weights - neurons; /* Minus one bias each. */
+    const int widest = genann_widest(ann);
+    const int nlayers = ann->layers + 1;
+
+    /* Allocate extra size for activations, scales, biases, outputs, widths,
+     * weights and scratch. */
+    const size_t size = sizeof(genann_q8) + sizeof(genann_activation) * nlayers
+        + sizeof(genann_real) * (2 * neurons + ann->total_neurons)
+        + sizeof(int) * nlayers + qweights + widest;
+    genann_q8 *q = malloc(size);
+    if (!q) return 0;
+
+    q->inputs = ann->inputs;
+    q->hidden_layers = ann->hidden_layers;
+    q->hidden = ann->hidden;
+    q->outputs = ann->outputs;
+    q->layers = ann->layers;
+    q->total_weights = ann->total_weights;
+    q->total_neurons = ann->total_neurons;
+
+    /* Set pointers. */
+    q->activation = (genann_activation*)((char*)q + sizeof(genann_q8));
+    q->scale = (genann_real*)(q->activation + nlayers);
+    q->bias = q->scale + neurons;
+    q->output = q->bias + neurons;
+    q->layer_size = (int*)(q->output + ann->total_neurons);
+    q->weight = (signed char*)(q->layer_size + nlayers);
+    q->qinput = q->weight + qweights;
+
+    genann_real const *w = ann->weight;
+    signed char *qw = q->weight;
+    int l, j, n = 0;
+
+    q->layer_size[0] = ann->inputs;
+    memset(&q->activation[0], 0, sizeof(genann_activation));
+
+    for (l = 1; l <= ann->layers; ++l) {
+        const int nin = ann->layer_size[l-1];
+        q->layer_size[l] = ann->layer_size[l];
+        q->activation[l] = genann_layer_activation(ann, l);
+        for (j = 0; j < ann->layer_size[l]; ++j, ++n) {
+            q->bias[n] = *w++;
+            q->scale[n] = genann_q8_pack(w, nin, qw);
+            w += nin;
+            qw += nin;
+        }
+    }
+
+    assert(w - ann->weight == ann->total_weights);
+    assert(n == neurons);
+
+    return q;
+}
+
+
+void genann_q8_free(genann_q8 *q) {
+    /* Everything is in the one buffer. */
+    free(q);
+}
+
+
+genann_real const *genann_q8_run(genann_q8 const *q, genann_real const *inputs) {
+    signed char const *w = q->weight;
+    genann_real const *scale = q->scale;
+    genann_real const *bias = q->bias;
+    genann_real const *i = q->output;
+    genann_real *o = q->output + q->inputs;
+
+    memcpy(q->output, inputs, sizeof(genann_real) * q->inputs);
+
+    int l, j;
+
+    for (l = 1; l <= q->layers; ++l) {
+        const int nin = q->layer_size[l-1];
+        const int nout = q->layer_size[l];
+
+        /* Each layer's inputs get their own scale. */
+        const genann_real xs = genann_q8_pack(i, nin, q->qinput);
+
+        for (j = 0; j < nout; ++j) {
+            const genann_real sum = *bias++ * -1.0
+                + (genann_real)genann_dot_q8(w, q->qinput, nin) * (*scale++ * xs);
+            *o++ = sum;
+            w += nin;
+        }
+        genann_activate(0, &q->activation[l], o - nout, nout);
+
+        i += nin;
+    }
+
+    assert(o - q->output == q->total_neurons);
+
+    return o - q->outputs;
+}
+
+
+double genann_q8_error(genann_q8 const *q, genann const *ann, genann_real const *inputs, int n) {
+    genann_real *expect = malloc(sizeof(genann_real) * (size_t)n * ann->outputs);
+    if (!expect) return -1;
+
+    if (genann_run_batch(ann, inputs, n, expect)) {
+        free(expect);
+        return -1;
+    }
+
+    double max = 0;
+    int s, j;
+    for (s = 0; s < n; ++s) {
+        genann_real const *out = genann_q8_run(q, inputs + (long long)s * ann->inputs);
+        for (j = 0; j < ann->outputs; ++j) {
+            const double e = fabs(out[j] - expect[(long long)s * ann->outputs + j]);
+            if (e > max) max = e;
+        }
+    }
+
+    free(expect);
+    return max;
+}
+
+
+
+/* Allocates a sparse ann with room for the given number of connections. */
+static genann_sparse *genann_sparse_alloc(int nlayers, int const *sizes, long long total_weights) {
+    if (nlayers < 2 || nlayers > GENANN_MAX_DIMENSION) return 0;
+    if (total_weights < 0 || total_weights > INT_MAX / 32) return 0;
+
+    long long total_neurons = 0;
+    int hidden = 0;
+    int l;
+
+    for (l = 0; l < nlayers; ++l) {
+        if (sizes[l] < 1 || sizes[l] > GENANN_MAX_DIMENSION) return 0;
+        total_neurons += sizes[l];
+        if (l > 0 && l < nlayers - 1 && sizes[l] > hidden) hidden = sizes[l];
+        if (total_neurons > INT_MAX / 32) return 0;
+    }
+
+    const int neurons = total_neurons - sizes[0];
+
+    /* Allocate extra size for activations, biases, deltas, outputs,
+     * weights, widths, rows and indexes. */
+    const size_t size = sizeof(genann_sparse) + sizeof(genann_activation) * nlayers
+        + sizeof(genann_real) * (2 * neurons + total_neurons + total_weights)
+        + sizeof(int) * (nlayers + neurons + 1 + total_weights);
+    genann_sparse *s = malloc(size);
+    if (!s) return 0;
+
+    s->inputs = sizes[0];
+    s->hidden_layers = nlayers - 2;
+    s->hidden = hidden;
+    s->outputs = sizes[nlayers - 1];
+    s->layers = nlayers - 1;
+    s->total_neurons = total_neurons;
+    s->total_weights = total_weights;
+
+    /* Set pointers. */
+    s->activation = (genann_activation*)((char*)s + sizeof(genann_sparse));
+    s->bias = (genann_real*)(s->activation + nlayers);
+    s->delta = s->bias + neurons;
+    s->output = s->delta + neurons;
+    s->weight = s->output + total_neurons;
+    s->layer_size = (int*)(s->weight + total_weights);
+    s->row_start = s->layer_size + nlayers;
+    s->index = s->row_start + neurons + 1;
+
+    memset(&s->activation[0], 0, sizeof(genann_activation));
+    for (l = 0; l < nlayers; ++l) s->layer_size[l] = sizes[l];
+
+    return s;
+}
+
+
+static int genann_compare_real(const void *a, const void *b) {
+    const genann_real x = *(genann_real const *)a, y = *(genann_real const *)b;
+    return (x > y) - (x < y);
+}
+
+
+double genann_prune_threshold(genann const *ann, double fraction) {
+    const int n = ann->total_weights - (ann->total_neurons - ann->inputs);
+    if (fraction <= 0 || n == 0) return 0;
+    if (fraction >= 1) return HUGE_VAL;
+
+    genann_real *m = malloc(sizeof(genann_real) * n);
+    if (!m) return -1;
+
+    genann_real const *w = ann->weight;
+    int l, j, k, c = 0;
+
+    for (l = 1; l <= ann->layers; ++l) {
+        for (j = 0; j < ann->layer_size[l]; ++j) {
+            ++w; /* Skip the bias. */
+            for (k = 0; k < ann->layer_size[l-1]; ++k) m[c++] = fabs(*w++);
+        }
+    }
+
+    qsort(m, n, sizeof(genann_real), genann_compare_real);
+
+    c = (int)(fraction * n);
+    const double threshold = m[c < n ? c : n - 1];
+
+    free(m);
+    return threshold;
+}
+
+
+genann_sparse *genann_prune(genann const *ann, double threshold) {
+    genann_real const *w = ann->weight;
+    long long kept = 0;
+    int l, j, k;
+
+    for (l = 1; l <= ann->layers; ++l) {
+        for (j = 0; j < ann->layer_size[l]; ++j) {
+            ++w;
+            for (k = 0; k < ann->layer_size[l-1]; ++k, ++w) {
+                if (fabs(*w) >= threshold) ++kept;
+            }
+        }
+    }
+
+    genann_sparse *s = genann_sparse_alloc(ann->layers + 1, ann->layer_size, kept);
+    if (!s) return 0;
+
+    int r = 0, c = 0;
+    w = ann->weight;
+
+    for (l = 1; l <= ann->layers; ++l) {
+        s->activation[l] = genann_layer_activation(ann, l);
+        for (j = 0; j < ann->layer_size[l]; ++j, ++r) {
+            s->bias[r] = *w++;
+            s->row_start[r] = c;
+            for (k = 0; k < ann->layer_size[l-1]; ++k, ++w) {
+                if (fabs(*w) >= threshold) {
+                    s->index[c] = k;
+                    s->weight[c] = *w;
+                    ++c;
+                }
+            }
+        }
+    }
+    s->row_start[r] = c;
+
+    assert(w - ann->weight == ann->total_weights);
+    assert(c == kept);
+
+    return s;
+}
+
+
+void genann_sparse_free(genann_sparse *s) {
+    /* Everything is in the one buffer. */
+    free(s);
+}
+
+
+genann_real const *genann_sparse_run(genann_sparse const *s, genann_real const *inputs) {
+    genann_real const *i = s->output;
+    genann_real *o = s->output + s->inputs;
+    int l, j, r = 0;
+
+    memcpy(s->output, inputs, sizeof(genann_real) * s->inputs);
+
+    for (l = 1; l <= s->layers; ++l) {
+        const int nout = s->layer_size[l];
+
+        for (j = 0; j < nout; ++j, ++r) {
+            const int c = s->row_start[r];
+            o[j] = s->bias[r] * -1.0
+                + genann_dot_sparse(s->weight + c, s->index + c, i, s->row_start[r+1] - c);
+        }
+        genann_activate(0, &s->activation[l], o, nout);
+
+        i = o;
+        o += nout;
+    }
+
+    assert(o - s->output == s->total_neurons);
+
+    return o - s->outputs;
+}
+
+
+void genann_sparse_train(genann_sparse const *s, genann_real const *inputs, genann_real const *desired_outputs, double learning_rate) {
+    const int L = s->layers;
+    const int neurons = s->total_neurons - s->inputs;
+    genann_real const *o = s->output + s->inputs; /* First hidden neuron. */
+    genann_real *d = s->delta;
+    int l, j, c;
+
+    genann_sparse_run(s, inputs);
+
+    /* Set output layer deltas. */
+    int first = neurons - s->outputs;
+    for (j = 0; j < s->outputs; ++j) {
+        d[first + j] = desired_outputs[j] - o[first + j];
+    }
+    genann_activate_derivative(0, &s->activation[L], o + first, d + first, s->outputs);
+
+    /* Set hidden layer deltas, scattering each delta of the following layer
+     * back along its connections. */
+    for (l = L - 1; l >= 1; --l) {
+        const int n = s->layer_size[l];
+        const int nnext = s->layer_size[l+1];
+        genann_real *dh = d + first - n;
+
+        memset(dh, 0, sizeof(genann_real) * n);
+        for (j = 0; j < nnext; ++j) {
+            const genann_real dd = d[first + j];
+            for (c = s->row_start[first + j]; c < s->row_start[first + j + 1]; ++c) {
+                dh[s->index[c]] += dd * s->weight[c];
+            }
+        }
+        genann_activate_derivative(0, &s->activation[l], o + first - n, dh, n);
+
+        first -= n;
+    }
+
+    /* Train the connections that remain. */
+    genann_real const *i = s->output;
+    int r = 0;
+
+    for (l = 1; l <= L; ++l) {
+        for (j = 0; j < s->layer_size[l]; ++j, ++r) {
+            const genann_real a = d[r] * learning_rate;
+            c = s->row_start[r];
+            s->bias[r] += a * -1.0;
+            genann_axpy_sparse(s->weight + c, s->index + c, a, i, s->row_start[r+1] - c);
+        }
+        i += s->layer_size[l-1];
+    }
+}
+
+
+genann *genann_sparse_dense(genann_sparse const *s) {
+    genann *ann = genann_alloc(s->layers + 1, s->layer_size, 1);
+    if (!ann) return 0;
+
+    /* Custom activations become the default, as when loading a file. */
+    const int ah = s->activation[1].id, ao = s->activation[s->layers].id;
+    genann_set_activation_hidden(ann, genann_builtin_activation(ah, &genann_activation_sigmoid_cached));
+    genann_set_activation_output(ann, genann_builtin_activation(ao, &genann_activation_sigmoid_cached));
+
+    int l, j, c, r = 0;
+    genann_real *w = ann->weight;
+
+    for (l = 1; l <= s->layers; ++l) {
+        if (l < s->layers && s->activation[l].id != ah) {
+            genann_set_activation_layer(ann, l, genann_builtin_activation(s->activation[l].id, &genann_activation_sigmoid_cached));
+        }
+
+        for (j = 0; j < s->layer_size[l]; ++j, ++r) {
+            *w++ = s->bias[r];
+            memset(w, 0, sizeof(genann_real) * s->layer_size[l-1]);
+            for (c = s->row_start[r]; c < s->row_start[r+1]; ++c) w[s->index[c]] = s->weight[c];
+            w += s->layer_size[l-1];
+        }
+    }
+
+    assert(w - ann->weight == ann->total_weights);
+
+    genann_init_sigmoid_lookup(ann);
+
+    return ann;
+}
+
+
+int genann_sparse_write(genann_sparse const *s, FILE *out) {
+    const int nlayers = s->layers + 1;
+    const size_t neurons = s->total_neurons - s->inputs;
+    const size_t values = neurons + s->total_weights;
+    const size_t bytes = 8 * (size_t)nlayers + 4 * values + sizeof(genann_real) * values;
+    unsigned char header[GENANN_BINARY_HEADER] = {0};
+    size_t k;
+    int l;
+
+    unsigned char *data = malloc(bytes);
+    if (!data) return -1;
+    unsigned char *p = data;
+
+    for (l = 0; l < nlayers; ++l, p += 8) {
+        genann_put32(p, s->layer_size[l]);
+        genann_put32(p + 4, l ? s->activation[l].id : GENANN_ACT_CUSTOM);
+    }
+    for (k = 0; k < neurons; ++k, p += 4) genann_put32(p, s->row_start[k+1] - s->row_start[k]);
+    for (k = 0; k < (size_t)s->total_weights; ++k, p += 4) genann_put32(p, s->index[k]);
+
+    /* Reals are stored little-endian. */
+    memcpy(p, s->bias, sizeof(genann_real) * neurons);
+    memcpy(p + sizeof(genann_real) * neurons, s->weight, sizeof(genann_real) * s->total_weights);
+    if (!genann_little_endian()) genann_swap_bytes(p, values, sizeof(genann_real));
+
+    const uint64_t sum = genann_checksum(GENANN_CHECKSUM_INIT, data, bytes);
+
+    memcpy(header, GENANN_BINARY_MAGIC, 8);
+    genann_put32(header + GENANN_BH_VERSION, GENANN_BINARY_VERSION_SPARSE);
+    genann_put32(header + GENANN_BH_BOM, GENANN_BINARY_BOM);
+    genann_put32(header + GENANN_BH_REAL, sizeof(genann_real));
+    genann_put32(header + GENANN_BH_INPUTS, s->inputs);
+    genann_put32(header + GENANN_BH_HIDDEN_LAYERS, s->hidden_layers);
+    genann_put32(header + GENANN_BH_HIDDEN, s->hidden);
+    genann_put32(header + GENANN_BH_OUTPUTS, s->outputs);
+    genann_put32(header + GENANN_BH_ACT_HIDDEN, s->activation[1].id);
+    genann_put32(header + GENANN_BH_ACT_OUTPUT, s->activation[s->layers].id);
+    genann_put32(header + GENANN_BH_TOTAL_WEIGHTS, s->total_weights);
+    genann_put32(header + GENANN_BH_CHECKSUM, (uint32_t)sum);
+    genann_put32(header + GENANN_BH_CHECKSUM + 4, (uint32_t)(sum >> 32));
+
+    int rc = 0;
+    if (fwrite(header, sizeof(header), 1, out) != 1) rc = -1;
+    if (!rc && fwrite(data, bytes, 1, out) != 1) rc = -1;
+
+    free(data);
+    return rc;
+}
+
+
+/* Decodes n little-endian reals of the given size. */
+static void genann_get_reals(genann_real *x, unsigned char const *p, size_t n, int real) {
+    size_t i;
+
+    if (real == sizeof(genann_real)) {
+        memcpy(x, p, real * n);
+        if (!genann_little_endian()) genann_swap_bytes(x, n, real);
+        return;
+    }
+
+    for (i = 0; i < n; ++i, p += real) {
+        unsigned char b[sizeof(double)];
+        memcpy(b, p, real);
+        if (!genann_little_endian()) genann_swap_bytes(b, 1, real);
+        if (real == sizeof(float)) {
+            float f;
+            memcpy(&f, b, sizeof(f));
+            x[i] = f;
+        } else {
+            double v;
+            memcpy(&v, b, sizeof(v));
+            x[i] = v;
+        }
+    }
+}
+
+
+/* Returns the number of bytes left to read in a seekable file, or -1 if it
+ * can't be told, as for a pipe. */
+static long long genann_file_remaining(FILE *in) {
+    const long here = ftell(in);
+    if (here < 0 || fseek(in, 0, SEEK_END)) return -1;
+    const long end = ftell(in);
+    if (fseek(in, here, SEEK_SET) || end < here) return -1;
+    return end - here;
+}
+
+
+genann_sparse *genann_sparse_read(FILE *in) {
+    unsigned char header[GENANN_BINARY_HEADER];
+    int l;
+
+    if (fread(header, sizeof(header), 1, in) != 1) return NULL;
+    if (memcmp(header, GENANN_BINARY_MAGIC, 8) != 0
+            || genann_get32(header + GENANN_BH_BOM) != GENANN_BINARY_BOM
+            || genann_get32(header + GENANN_BH_VERSION) != GENANN_BINARY_VERSION_SPARSE) {
+        return NULL;
+    }
+
+    const int real = genann_get32(header + GENANN_BH_REAL);
+    const int32_t hidden_layers = genann_get32(header + GENANN_BH_HIDDEN_LAYERS);
+    const int32_t total_weights = genann_get32(header + GENANN_BH_TOTAL_WEIGHTS);
+    if (real != sizeof(float) && real != sizeof(double)) return NULL;
+    if (hidden_layers < 0 || hidden_layers > GENANN_MAX_DIMENSION - 2) return NULL;
+
+    /* The layer table gives the size of everything else. Its length is a
+     * multiple of 8, so the checksum can be taken in two parts. */
+    const int nlayers = hidden_layers + 2;
+    long long remaining = genann_file_remaining(in);
+    if (remaining >= 0 && remaining < 8LL * nlayers) return NULL;
+
+    unsigned char *table = malloc(8 * (size_t)nlayers);
+    int *sizes = malloc(sizeof(int) * nlayers);
+    if (!table || !sizes || fread(table, 8 * (size_t)nlayers, 1, in) != 1) {
+        free(table);
+        free(sizes);
+        return NULL;
+    }
+    uint64_t sum = genann_checksum(GENANN_CHECKSUM_INIT, table, 8 * (size_t)nlayers);
+    if (remaining >= 0) remaining -= 8LL * nlayers;
+
+    /* Nothing is sized from the header's counts until they agree with the
+     * table, and with the length of the file where it is known. */
+    long long neurons_in_file = 0, dense = 0;
+    for (l = 0; l < nlayers; ++l) {
+        sizes[l] = (int32_t)genann_get32(table + 8 * l);
+        if (sizes[l] < 1 || sizes[l] > GENANN_MAX_DIMENSION) break;
+        if (l) {
+            neurons_in_file += sizes[l];
+            dense += (long long)sizes[l] * sizes[l-1];
+        }
+    }
+    if (l < nlayers || total_weights < 0 || total_weights > dense
+            || sizes[0] != (int32_t)genann_get32(header + GENANN_BH_INPUTS)
+            || sizes[nlayers-1] != (int32_t)genann_get32(header + GENANN_BH_OUTPUTS)
+            || (remaining >= 0 && remaining < (4LL + real) * (neurons_in_file + total_weights))) {
+        free(table);
+        free(sizes);
+        return NULL;
+    }
+
+    genann_sparse *s = genann_sparse_alloc(nlayers, sizes, total_weights);
+    free(sizes);
+
+    if (!s || s->inputs != (int32_t)genann_get32(header + GENANN_BH_INPUTS)
+            || s->outputs != (int32_t)genann_get32(header + GENANN_BH_OUTPUTS)) {
+        free(table);
+        genann_sparse_free(s);
+        return NULL;
+    }
+
+    for (l = 1; l < nlayers; ++l) {
+        s->activation[l] = *genann_builtin_activation(genann_get32(table + 8 * l + 4), &genann_activation_sigmoid_cached);
+    }
+    free(table);
+
+    const size_t neurons = s->total_neurons - s->inputs;
+    const size_t values = neurons + s->total_weights;
+    const size_t bytes = (4 + real) * values;
+    unsigned char *data = malloc(bytes);
+    if (!data || fread(data, bytes, 1, in) != 1
+            || genann_checksum(sum, data, bytes) != genann_binary_checksum(header)) {
+        free(data);
+        genann_sparse_free(s);
+        return NULL;
+    }
+
+    /* Rebuild the rows, checking every index against its layer. */
+    unsigned char const *p = data;
+    size_t r = 0;
+    long long c = 0;
+    int j, ok = 1;
+
+    for (l = 1; l < nlayers && ok; ++l) {
+        for (j = 0; j < s->layer_size[l]; ++j, ++r, p += 4) {
+            const uint32_t count = genann_get32(p);
+            s->row_start[r] = c;
+            if (count > (uint32_t)s->layer_size[l-1] || c + count > s->total_weights) ok = 0;
+            else c += count;
+        }
+    }
+    s->row_start[neurons] = c;
+    if (c != s->total_weights) ok = 0;
+
+    for (l = 1, r = 0; l < nlayers && ok; ++l) {
+        for (j = 0; j < s->layer_size[l]; ++j, ++r) {
+            for (c = s->row_start[r]; c < s->row_start[r+1]; ++c, p += 4) {
+                s->index[c] = (int32_t)genann_get32(p);
+                if (s->index[c] < 0 || s->index[c] >= s->layer_size[l-1]) ok = 0;
+            }
+        }
+    }
+
+    if (!ok) {
+        free(data);
+        genann_sparse_free(s);
+        return NULL;
+    }
+
+    genann_get_reals(s->bias, p, neurons, real);
+    genann_get_reals(s->weight, p + real * neurons, s->total_weights, real);
+    free(data);
+
+    genann_init_sigmoid_lookup(0);
+
+    return s;
+}
@@ -39,20 +39,87 @@ extern "C" {
 #define GENANN_RANDOM() (((double)rand())/RAND_MAX)
 #endif
 
+#ifndef GENANN_REAL
+/* Type of weights, inputs, outputs and all other per-neuron values.
+ * Build with -DGENANN_REAL=float for a single precision library, which uses
+ * half the memory and memory bandwidth. Saved text files work with either. */
+#define GENANN_REAL double
+#endif
+
+typedef GENANN_REAL genann_real;
+
 struct genann;
 
-typedef double (*genann_actfun)(const struct genann *ann, double a);
+/* Memory reserved up front for many anns; see genann_arena_init. */
+typedef struct genann_arena genann_arena;
+
+typedef genann_real (*genann_actfun)(const struct genann *ann, genann_real a);
+
+/* Ids of the built-in activation functions, as saved by genann_write_binary. */
+enum {
+    GENANN_ACT_CUSTOM = -1,
+    GENANN_ACT_SIGMOID_CACHED,
+    GENANN_ACT_SIGMOID,
+    GENANN_ACT_THRESHOLD,
+    GENANN_ACT_LINEAR,
+    GENANN_ACT_TANH,
+    GENANN_ACT_RELU
+};
+
+/* Everything run and train need to know about an activation function. */
+typedef struct genann_activation {
+    /* One of the GENANN_ACT_ ids, or GENANN_ACT_CUSTOM. */
+    int id;
+
+    /* The function itself. */
+    genann_actfun forward;
+
+    /* Its derivative, given the function's output rather than its input. If
+     * NULL, backprop assumes the sigmoid's derivative. */
+    genann_actfun derivative;
+
+    /* Optional. Applies forward to n values in place. */
+    void (*forward_layer)(const struct genann *ann, genann_real *a, int n);
+
+    /* Optional. Multiplies each d[i] by the derivative at output y[i]. */
+    void (*derivative_layer)(const struct genann *ann, genann_real const *y, genann_real *d, int n);
+
+} genann_activation;
 
 typedef struct genann {
-    /* How many inputs, outputs, and hidden neurons. */
+    /* How many inputs, outputs, and hidden neurons. If the hidden layers
+     * differ in width (see genann_init_layers), hidden is the widest. */
     int inputs, hidden_layers, hidden, outputs;
 
+    /* Number of layers after the inputs (hidden_layers + 1). Layer 0 is the
+     * inputs and layer 'layers' is the outputs. */
+    int layers;
+
+    /* Width of each layer (layers + 1 long). */
+    int *layer_size;
+
+    /* Index of each layer's first neuron in output (layers + 1 long). */
+    int *neuron_offset;
+
+    /* Index of the first weight into each layer (layers + 1 long, the first
+     * being 0 as the inputs have no weights). */
+    int *weight_offset;
+
+    /* Activation of each layer, overriding activation_hidden and
+     * activation_output where not NULL (layers + 1 long, the first unused).
+     * Set with genann_set_activation_layer. */
+    genann_activation const **layer_activation;
+
     /* Which activation function to use for hidden neurons. Default: gennann_act_sigmoid_cached*/
     genann_actfun activation_hidden;
 
     /* Which activation function to use for output. Default: gennann_act_sigmoid_cached*/
     genann_actfun activation_output;
 
+    /* Descriptors for the above, set by genann_set_activation_hidden/output.
+     * Ignored if the function pointer above has been changed since. */
+    genann_activation const *activation_hidden_desc, *activation_output_desc;
+
     /* Total number of weights, and size of weights buffer. */
     int total_weights;
 
@@ -60,19 +127,162 @@ typedef struct genann {
     int total_neurons;
 
     /* All weights (total_weights long). */
-    double *weight;
+    genann_real *weight;
 
     /* Stores input array and output of each neuron (total_neurons long). */
-    double *output;
+    genann_real *output;
 
     /* Stores delta of each hidden and output neuron (total_neurons - inputs long). */
-    double *delta;
+    genann_real *delta;
+
+    /* Read-only file mapping holding the weights, if any (see genann_open_mmap). */
+    void *mapping;
+    size_t mapping_size;
+
+    /* Arena the ann was allocated from, if any (see genann_init_in). */
+    genann_arena *arena;
 
 } genann;
 
+
+/* Scratch space for running or training a shared ann from one thread.
+ * Holds what genann keeps in output and delta, minus the input copy. */
+typedef struct genann_workspace {
+    /* Number of hidden and output neurons (total_neurons - inputs). */
+    int neurons;
+
+    /* Output of each hidden and output neuron (neurons long). */
+    genann_real *output;
+
+    /* Delta of each hidden and output neuron (neurons long). */
+    genann_real *delta;
+
+    /* Scratch for genann_run_batch_ws, or NULL if the workspace came from
+     * genann_workspace_init. */
+    genann_real *batch;
+
+} genann_workspace;
+
+/* An inference-only copy of an ann with 8-bit weights; see genann_quantize. */
+typedef struct genann_q8 {
+    /* Topology, as in the ann it was made from. */
+    int inputs, hidden_layers, hidden, outputs;
+    int layers;
+    int *layer_size;
+    int total_weights, total_neurons;
+
+    /* Activation of each layer (layers + 1 long, the first unused). */
+    genann_activation *activation;
+
+    /* Weights without biases, one row per neuron (total_weights - total_neurons + inputs long). */
+    signed char *weight;
+
+    /* Scale and bias of each hidden and output neuron. */
+    genann_real *scale;
+    genann_real *bias;
+
+    /* Stores input array and output of each neuron (total_neurons long). */
+    genann_real *output;
+
+    /* Scratch for the quantized inputs of one layer. */
+    signed char *qinput;
+
+} genann_q8;
+
+
+/* An ann with its small weights pruned away; see genann_prune. Each hidden
+ * and output neuron keeps its bias and a compressed row (CSR) of the
+ * connections that remain. */
+typedef struct genann_sparse {
+    /* Topology, as in the ann it was made from. */
+    int inputs, hidden_layers, hidden, outputs;
+    int layers;
+    int *layer_size;
+    int total_neurons;
+
+    /* Number of connections kept, not counting biases. */
+    int total_weights;
+
+    /* Activation of each layer (layers + 1 long, the first unused). */
+    genann_activation *activation;
+
+    /* Connections of hidden or output neuron n are row_start[n] up to
+     * row_start[n+1] in index and weight (total_neurons - inputs + 1 long). */
+    int *row_start;
+
+    /* Which neuron of the previous layer each connection comes from, and
+     * its weight (total_weights long). */
+    int *index;
+    genann_real *weight;
+
+    /* Bias of each hidden and output neuron. */
+    genann_real *bias;
+
+    /* Stores input array and output of each neuron (total_neurons long). */
+    genann_real *output;
+
+    /* Stores delta of each hidden and output neuron (total_neurons - inputs long). */
+    genann_real *delta;
+
+} genann_sparse;
+
+
+/* Update rules for genann_optimizer. */
+enum {
+    GENANN_OPT_SGD,
+    GENANN_OPT_MOMENTUM,
+    GENANN_OPT_NESTEROV,
+    GENANN_OPT_RMSPROP,
+    GENANN_OPT_ADAM
+};
+
+/* Training state for an update rule other than plain SGD; see
+ * genann_optimizer_init. The fields may be changed between steps. */
+typedef struct genann_optimizer {
+    /* One of the GENANN_OPT_ values. */
+    int type;
+
+    /* Step size. */
+    double learning_rate;
+
+    /* Decay of the gradient average (momentum for MOMENTUM and NESTEROV).
+     * Default: 0.9 */
+    double beta1;
+
+    /* Decay of the squared gradient average. Default: 0.9 for RMSPROP,
+     * 0.999 for ADAM. */
+    double beta2;
+
+    /* Added to the RMS to avoid dividing by zero. Default: 1e-8 */
+    double epsilon;
+
+    /* Every step shrinks all weights, biases included, by
+     * learning_rate * weight_decay of themselves. Default: 0 */
+    double weight_decay;
+
+    /* Number of steps taken. */
+    long long steps;
+
+    /* Number of weights, as in the ann it was made for. */
+    int total_weights;
+
+    /* Running averages for the weights, laid out like ann->weight, or NULL
+     * where the rule has none (total_weights long). */
+    genann_real *m, *v;
+
+    /* Scratch for genann_train_opt's gradient (total_weights long). */
+    genann_real *grad;
+
+} genann_optimizer;
+
+
 /* Creates and returns a new ann. */
 genann *genann_init(int inputs, int hidden_layers, int hidden, int outputs);
 
+/* Creates and returns a new ann with nlayers layers of the given widths,
+ * the first being the inputs and the last the outputs. */
+genann *genann_init_layers(int nlayers, const int *sizes);
+
 /* Creates ANN from file saved with genann_write. */
 genann *genann_read(FILE *in);
 
@@ -82,25 +292,245 @@ void genann_randomize(genann *ann);
 /* Returns a new copy of ann. */
 genann *genann_copy(genann const *ann);
 
-/* Frees the memory used by an ann. */
+/* Copies everything but the topology from src to dst, which must have
+ * layers of the same widths. Returns 0 on success or -1 if they differ. */
+int genann_copy_into(genann *dst, genann const *src);
+
+/* Copies only the weights from src to dst, as for genann_copy_into. */
+int genann_copy_weights(genann *dst, genann const *src);
+
+/* Frees the memory used by an ann. Anns from an arena go back to it. */
 void genann_free(genann *ann);
 
+/* Reserves bytes of memory for anns, aligned to 64 bytes. Not thread-safe:
+ * only one thread at a time may create or free anns in an arena. */
+genann_arena *genann_arena_init(size_t bytes);
+
+/* Like genann_init and genann_copy, but takes the ann's memory from arena.
+ * Freeing the ann returns its memory to the arena, where the next ann of
+ * the same size reuses it. Returns NULL if the arena is full. */
+genann *genann_init_in(genann_arena *arena, int inputs, int hidden_layers, int hidden, int outputs);
+genann *genann_copy_in(genann_arena *arena, genann const *ann);
+
+/* Makes all of arena free again, invalidating every ann created from it. */
+void genann_arena_reset(genann_arena *arena);
+
+/* Frees an arena. Anns created from it become invalid. */
+void genann_arena_free(genann_arena *arena);
+
 /* Runs the feedforward algorithm to calculate the ann's output. */
-double const *genann_run(genann const *ann, double const *inputs);
+genann_real const *genann_run(genann const *ann, genann_real const *inputs);
+
+/* Creates a workspace sized for ann, or any ann of the same topology. */
+genann_workspace *genann_workspace_init(genann const *ann);
+
+/* Like genann_workspace_init, but also with room for genann_run_batch_ws,
+ * which is a few blocks of samples of the widest layer. */
+genann_workspace *genann_workspace_init_batch(genann const *ann);
+
+/* Frees a workspace. */
+void genann_workspace_free(genann_workspace *ws);
+
+/* Like genann_run, but reads inputs in place and writes only to ws, so any
+ * number of threads may run one ann at once with their own workspaces.
+ * Returns a pointer into ws->output. */
+genann_real const *genann_run_ws(genann const *ann, genann_workspace *ws, genann_real const *inputs);
+
+/* Runs n samples at once. Inputs are n rows of ann->inputs values and
+ * outputs receives n rows of ann->outputs values. Results match genann_run
+ * (see README for the floating point caveat). Returns 0 on success or -1 if
+ * scratch memory could not be allocated. Does not touch ann->output. */
+int genann_run_batch(genann const *ann, genann_real const *inputs, int n, genann_real *outputs);
+
+/* Like genann_run_batch, but uses ws, from genann_workspace_init_batch,
+ * instead of allocating scratch memory. Returns 0, or -1 if ws has no room
+ * for batches. */
+int genann_run_batch_ws(genann const *ann, genann_workspace *ws, genann_real const *inputs, int n, genann_real *outputs);
+
+/* Computes neurons first to last-1 of one layer (1 for the first hidden
+ * layer) from that layer's inputs, writing them to o[first] to o[last-1].
+ * Lets callers split a layer of genann_run across threads. */
+void genann_run_layer(genann const *ann, int layer, genann_real const *inputs, genann_real *o, int first, int last);
 
 /* Does a single backprop update. */
-void genann_train(genann const *ann, double const *inputs, double const *desired_outputs, double learning_rate);
+void genann_train(genann const *ann, genann_real const *inputs, genann_real const *desired_outputs, double learning_rate);
+
+/* Like genann_train, but returns the loss found on the way: the sum of the
+ * squared output errors, before the update. */
+double genann_train_ex(genann const *ann, genann_real const *inputs, genann_real const *desired_outputs, double learning_rate);
+
+/* Does the backprop update of genann_train for the inputs of the last
+ * genann_run (or genann_run_team) on ann, reusing its outputs instead of
+ * running the network again. Nothing else may run or train ann in between.
+ * Returns the loss, as genann_train_ex does. */
+double genann_backprop_from_last_run(genann const *ann, genann_real const *desired_outputs, double learning_rate);
+
+/* Like genann_train, but keeps all scratch state in ws. Weights are still
+ * updated in place, so concurrent training of one ann must be serialized. */
+void genann_train_ws(genann const *ann, genann_workspace *ws, genann_real const *inputs, genann_real const *desired_outputs, double learning_rate);
+
+/* Adds the gradient of the squared error, summed over n samples, into grad
+ * (total_weights long). Inputs and desired outputs are packed n rows each,
+ * as for genann_run_batch. Returns 0 on success or -1 if out of memory. */
+int genann_gradient(genann const *ann, genann_real const *inputs, genann_real const *desired_outputs, int n, genann_real *grad);
+
+/* Does a single backprop update using the gradient averaged over n samples.
+ * Returns 0 on success or -1 if out of memory. */
+int genann_train_batch(genann const *ann, genann_real const *inputs, genann_real const *desired_outputs, int n, double learning_rate);
+
+/* Creates optimizer state for training ann, or any ann with the same
+ * number of weights, with the given rule and defaults for its other fields.
+ * Returns NULL on error. */
+genann_optimizer *genann_optimizer_init(genann const *ann, int type, double learning_rate);
+
+/* Clears the running averages and step count. */
+void genann_optimizer_reset(genann_optimizer *opt);
+
+/* Frees optimizer state. */
+void genann_optimizer_free(genann_optimizer *opt);
+
+/* Updates the weights of ann from grad, the gradient summed over n samples
+ * as written by genann_gradient. Returns 0, or -1 (and leaves ann alone) if
+ * n < 1. */
+int genann_optimizer_step(genann_optimizer *opt, genann const *ann, genann_real const *grad, int n);
+
+/* Like genann_train_batch, but takes one step of opt. Returns 0 on success
+ * or -1 if out of memory. */
+int genann_train_opt(genann const *ann, genann_optimizer *opt, genann_real const *inputs, genann_real const *desired_outputs, int n);
 
 /* Saves the ann. */
 void genann_write(genann const *ann, FILE *out);
 
+/* Writes C source for a function name(inputs, outputs) that runs ann, with
+ * its weights and activations built in and no dependency on genann. Fails,
+ * returning -1, for custom activations, non-finite weights, or a name that
+ * isn't a C identifier; returns 0 on success. */
+int genann_export_c(genann const *ann, FILE *out, const char *name);
+
+/* Saves the ann, including its built-in activation functions, in a compact
+ * binary format. Returns 0 on success or -1 on error. */
+int genann_write_binary(genann const *ann, FILE *out);
+
+/* Creates ANN from file saved with genann_write_binary. Returns NULL if the
+ * file is invalid or its checksum doesn't match. */
+genann *genann_read_binary(FILE *in);
+
+/* Creates ANN from file saved with genann_write_binary by mapping the file
+ * into memory, so that all processes using the file share one copy of the
+ * weights. The weights are read-only and not checksummed; use genann_copy
+ * to get a trainable ann. Only supported on POSIX systems, and the file must
+ * match this build's genann_real. Returns NULL on error. */
+genann *genann_open_mmap(const char *path);
+
+/* Returns a quantized copy of ann for inference: int8 weights with one
+ * scale per neuron, and int32 accumulation against each layer's inputs
+ * quantized to int8. Activation functions are called with a NULL ann. */
+genann_q8 *genann_quantize(genann const *ann);
+
+/* Frees a quantized ann. */
+void genann_q8_free(genann_q8 *q);
+
+/* Runs the quantized ann, like genann_run. */
+genann_real const *genann_q8_run(genann_q8 const *q, genann_real const *inputs);
+
+/* Returns the largest difference between any output of q and of ann over n
+ * calibration samples (packed as for genann_run_batch), or -1 on error. */
+double genann_q8_error(genann_q8 const *q, genann const *ann, genann_real const *inputs, int n);
+
+/* Returns the magnitude below which the given fraction of ann's weights,
+ * biases aside, fall; pass it to genann_prune. Returns -1 if out of memory. */
+double genann_prune_threshold(genann const *ann, double fraction);
+
+/* Returns a sparse copy of ann without the weights smaller in magnitude
+ * than threshold. Biases are always kept. Activation functions are called
+ * with a NULL ann. Returns NULL if out of memory. */
+genann_sparse *genann_prune(genann const *ann, double threshold);
+
+/* Frees a sparse ann. */
+void genann_sparse_free(genann_sparse *s);
+
+/* Runs the sparse ann, like genann_run. */
+genann_real const *genann_sparse_run(genann_sparse const *s, genann_real const *inputs);
+
+/* Does a single backprop update of the weights that remain, like
+ * genann_train. Pruned connections stay pruned. */
+void genann_sparse_train(genann_sparse const *s, genann_real const *inputs, genann_real const *desired_outputs, double learning_rate);
+
+/* Returns a dense ann with the weights of s, pruned ones being zero.
+ * Returns NULL if out of memory. */
+genann *genann_sparse_dense(genann_sparse const *s);
+
+/* Saves the sparse ann in the binary format, storing only the weights that
+ * remain. Returns 0 on success or -1 on error. */
+int genann_sparse_write(genann_sparse const *s, FILE *out);
+
+/* Creates a sparse ann from a file saved with genann_sparse_write. Returns
+ * NULL if the file is invalid or its checksum doesn't match. */
+genann_sparse *genann_sparse_read(FILE *in);
+
+/* Sets the activation function for hidden or output neurons, along with its
+ * derivative and layer forms. Use these to train with custom activations. */
+void genann_set_activation_hidden(genann *ann, genann_activation const *act);
+void genann_set_activation_output(genann *ann, genann_activation const *act);
+
+/* Sets the activation function of one layer, from 1 for the first hidden
+ * layer to ann->layers for the outputs. Setting the hidden or output
+ * activation afterwards resets it. */
+void genann_set_activation_layer(genann *ann, int layer, genann_activation const *act);
+
+/* Layers past this share the last entry of each per-layer counter. */
+#ifndef GENANN_STATS_LAYERS
+#define GENANN_STATS_LAYERS 16
+#endif
+
+/* Counters kept by genann_run, genann_train, their _ws forms and
+ * genann_run_team when the library is built with GENANN_STATS. They are
+ * shared by all anns and threads. Times are in CPU cycles on x86 and
+ * clock() ticks elsewhere; a layer split across threads counts the cycles
+ * of every thread. */
+typedef struct genann_stats {
+    unsigned long long run_calls;
+    unsigned long long train_calls;
+
+    /* Entry l-1 is layer l; the first hidden layer is layer 1. Forward is
+     * the weighted sums, backward the deltas, activation the activation
+     * function and its derivative, and update the weight update. */
+    unsigned long long forward_cycles[GENANN_STATS_LAYERS];
+    unsigned long long backward_cycles[GENANN_STATS_LAYERS];
+    unsigned long long activation_cycles[GENANN_STATS_LAYERS];
+    unsigned long long update_cycles[GENANN_STATS_LAYERS];
+
+    /* Multiplies and adds against the weights, and weight bytes read and
+     * written. */
+    unsigned long long flops;
+    unsigned long long bytes;
+} genann_stats;
+
+/* Copies the current counters to out. Returns 0, or -1 (and zeroes out) if
+ * the library was built without GENANN_STATS. */
+int genann_stats_snapshot(genann_stats *out);
+
+/* Sets all counters to zero. */
+void genann_stats_reset(void);
+
+/* Counts one run, for code such as genann_run_team that runs an ann layer
+ * by layer with genann_run_layer, which counts the rest. */
+void genann_stats_count_run(void);
+
+extern const genann_activation genann_activation_sigmoid;
+extern const genann_activation genann_activation_sigmoid_cached;
+extern const genann_activation genann_activation_threshold;
+extern const genann_activation genann_activation_linear;
+extern const genann_activation genann_activation_tanh;
+extern const genann_activation genann_activation_relu;
+
 void genann_init_sigmoid_lookup(const genann *ann);
-double genann_act_sigmoid(const genann *ann, double a);
-double genann_act_sigmoid_cached(const genann *ann, double a);
-double genann_act_threshold(const genann *ann, double a);
-double genann_act_linear(const genann *ann, double a);
-double genann_act_tanh(const genann *ann, double a);
-double genann_act_relu(const genann *ann, double a);
+genann_real genann_act_sigmoid(const genann *ann, genann_real a);
+genann_real genann_act_sigmoid_cached(const genann *ann, genann_real a);
+genann_real genann_act_threshold(const genann *ann, genann_real a);
+genann_real genann_act_linear(const genann *ann, genann_real a);
+genann_real genann_act_tanh(const genann *ann, genann_real a);
+genann_real genann_act_relu(const genann *ann, genann_real a);
 
 
 #ifdef __cplusplus
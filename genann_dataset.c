@@ -0,0 +1,414 @@
+/*
+ * GENANN - Minimal C Artificial Neural Network
+ *
+ * Copyright (c) 2015-2018 Lewis Van Winkle
+ *
+ * http://CodePlea.com
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ */
+
+
+
+#include "genann_dataset.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(GENANN_NO_MMAP)
+#define GENANN_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* Layout of the dataset header. All fields are little-endian, and the rows
+ * follow at GENANN_DATASET_HEADER, which keeps them aligned for any
+ * genann_real. */
+#define GENANN_DATASET_MAGIC "GENANND\0"
+#define GENANN_DATASET_VERSION 1
+#define GENANN_DATASET_BOM 0x01020304u
+#define GENANN_DATASET_HEADER 64
+
+enum {
+    GENANN_DH_VERSION = 8,
+    GENANN_DH_BOM = 12,
+    GENANN_DH_REAL = 16,
+    GENANN_DH_INPUTS = 20,
+    GENANN_DH_OUTPUTS = 24,
+    GENANN_DH_ROWS = 32
+};
+
+/* Longest CSV line genann_dataset_convert_csv accepts. */
+#define GENANN_DATASET_LINE 65536
+
+
+static int genann_dataset_little_endian(void) {
+    const uint32_t one = 1;
+    unsigned char c;
+    memcpy(&c, &one, 1);
+    return c == 1;
+}
+
+
+static void genann_dataset_put32(unsigned char *p, uint32_t v) {
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+
+static uint32_t genann_dataset_get32(unsigned char const *p) {
+    return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+
+/* Reverses the bytes of each of n values of the given size. */
+static void genann_dataset_swap(void *data, size_t n, size_t size) {
+    unsigned char *p = data;
+    size_t i, j;
+    for (i = 0; i < n; ++i, p += size) {
+        for (j = 0; j < size / 2; ++j) {
+            const unsigned char t = p[j];
+            p[j] = p[size - 1 - j];
+            p[size - 1 - j] = t;
+        }
+    }
+}
+
+
+static int genann_dataset_write_header(FILE *out, int inputs, int outputs, long long rows) {
+    unsigned char header[GENANN_DATASET_HEADER] = {0};
+
+    memcpy(header, GENANN_DATASET_MAGIC, 8);
+    genann_dataset_put32(header + GENANN_DH_VERSION, GENANN_DATASET_VERSION);
+    genann_dataset_put32(header + GENANN_DH_BOM, GENANN_DATASET_BOM);
+    genann_dataset_put32(header + GENANN_DH_REAL, sizeof(genann_real));
+    genann_dataset_put32(header + GENANN_DH_INPUTS, inputs);
+    genann_dataset_put32(header + GENANN_DH_OUTPUTS, outputs);
+    genann_dataset_put32(header + GENANN_DH_ROWS, (uint32_t)rows);
+    genann_dataset_put32(header + GENANN_DH_ROWS + 4, (uint32_t)((unsigned long long)rows >> 32));
+
+    return fwrite(header, sizeof(header), 1, out) == 1 ? 0 : -1;
+}
+
+
+/* Writes n values little-endian. */
+static int genann_dataset_put(FILE *out, genann_real const *x, size_t n) {
+    if (genann_dataset_little_endian()) {
+        return !n || fwrite(x, sizeof(genann_real) * n, 1, out) == 1 ? 0 : -1;
+    }
+
+    genann_real chunk[1024];
+    while (n) {
+        const size_t c = n < 1024 ? n : 1024;
+        memcpy(chunk, x, sizeof(genann_real) * c);
+        genann_dataset_swap(chunk, c, sizeof(genann_real));
+        if (fwrite(chunk, sizeof(genann_real) * c, 1, out) != 1) return -1;
+        x += c;
+        n -= c;
+    }
+    return 0;
+}
+
+
+int genann_dataset_write(FILE *out, int inputs, int outputs, long long rows,
+        genann_real const *input, genann_real const *output) {
+    if (inputs < 1 || outputs < 1 || rows < 0) return -1;
+
+    if (genann_dataset_write_header(out, inputs, outputs, rows)) return -1;
+    if (genann_dataset_put(out, input, (size_t)rows * inputs)) return -1;
+    if (genann_dataset_put(out, output, (size_t)rows * outputs)) return -1;
+
+    return 0;
+}
+
+
+/* Parses the next comma separated number from *p into *x. */
+static int genann_dataset_field(char **p, genann_real *x) {
+    char *end;
+
+    errno = 0;
+    const double v = strtod(*p, &end);
+    if (end == *p || errno == ERANGE) return -1;
+
+    while (*end == ' ' || *end == '\t' || *end == '\r' || *end == '\n') ++end;
+    if (*end == ',') ++end;
+    else if (*end) return -1;
+
+    *x = v;
+    *p = end;
+    return 0;
+}
+
+
+long long genann_dataset_convert_csv(FILE *csv, FILE *out, int inputs, int outputs) {
+    if (inputs < 1 || outputs < 1) return -1;
+
+    /* The outputs go to a temporary file until all the inputs are written. */
+    FILE *tmp = tmpfile();
+    char *line = malloc(GENANN_DATASET_LINE);
+    genann_real *row = malloc(sizeof(genann_real) * (inputs + outputs));
+    char **classes = calloc(outputs, sizeof(char*));
+    long long rows = 0, lineno = 0;
+    int j, ok = tmp && line && row && classes;
+
+    ok = ok && !genann_dataset_write_header(out, inputs, outputs, 0);
+
+    while (ok && fgets(line, GENANN_DATASET_LINE, csv)) {
+        char *p = line;
+        ++lineno;
+
+        if (!strchr(line, '\n') && !feof(csv)) {
+            ok = 0; /* Line too long. */
+            break;
+        }
+
+        while (*p == ' ' || *p == '\t') ++p;
+        if (*p == '\n' || *p == '\r' || !*p) continue;
+
+        for (j = 0; j < inputs; ++j) {
+            if (genann_dataset_field(&p, row + j)) break;
+        }
+
+        if (j < inputs) {
+            /* A first line that doesn't parse is a header. */
+            if (lineno == 1 && j == 0) continue;
+            ok = 0;
+            break;
+        }
+
+        char *label = p;
+        for (j = 0; j < outputs; ++j) {
+            if (genann_dataset_field(&p, row + inputs + j)) break;
+        }
+
+        if (j == 0 && outputs > 1) {
+            /* A class name, which sets its one output to 1. */
+            label[strcspn(label, "\r\n")] = 0;
+            int c;
+            for (c = 0; c < outputs && classes[c] && strcmp(classes[c], label); ++c);
+            if (c == outputs || !*label) {
+                ok = 0; /* More classes than outputs. */
+                break;
+            }
+            if (!classes[c]) {
+                classes[c] = malloc(strlen(label) + 1);
+                if (!classes[c]) {
+                    ok = 0;
+                    break;
+                }
+                strcpy(classes[c], label);
+            }
+            for (j = 0; j < outputs; ++j) row[inputs + j] = j == c;
+        } else if (j < outputs || *p) {
+            ok = 0;
+            break;
+        }
+
+        ok = !genann_dataset_put(out, row, inputs) && !genann_dataset_put(tmp, row + inputs, outputs);
+        ++rows;
+    }
+
+    ok = ok && !ferror(csv);
+
+    /* Append the outputs, then fill in the row count. */
+    if (ok) {
+        rewind(tmp);
+        size_t n;
+        while ((n = fread(line, 1, GENANN_DATASET_LINE, tmp)) > 0) {
+            if (fwrite(line, 1, n, out) != n) ok = 0;
+        }
+        ok = ok && !ferror(tmp);
+    }
+
+    ok = ok && !fseek(out, 0, SEEK_SET) && !genann_dataset_write_header(out, inputs, outputs, rows);
+    ok = ok && !fseek(out, 0, SEEK_END);
+
+    if (classes) {
+        for (j = 0; j < outputs; ++j) free(classes[j]);
+    }
+    free(classes);
+    free(row);
+    free(line);
+    if (tmp) fclose(tmp);
+
+    return ok ? rows : -1;
+}
+
+
+/* Checks a header against the file size and returns the number of rows, or
+ * -1 if the file is not a dataset. */
+static long long genann_dataset_check(unsigned char const *header, long long size, int *real, int *inputs, int *outputs) {
+    if (size < GENANN_DATASET_HEADER) return -1;
+    if (memcmp(header, GENANN_DATASET_MAGIC, 8) != 0) return -1;
+    if (genann_dataset_get32(header + GENANN_DH_VERSION) != GENANN_DATASET_VERSION) return -1;
+    if (genann_dataset_get32(header + GENANN_DH_BOM) != GENANN_DATASET_BOM) return -1;
+
+    *real = genann_dataset_get32(header + GENANN_DH_REAL);
+    *inputs = (int32_t)genann_dataset_get32(header + GENANN_DH_INPUTS);
+    *outputs = (int32_t)genann_dataset_get32(header + GENANN_DH_OUTPUTS);
+    const long long rows = genann_dataset_get32(header + GENANN_DH_ROWS)
+        | (long long)genann_dataset_get32(header + GENANN_DH_ROWS + 4) << 32;
+
+    if (*real != sizeof(float) && *real != sizeof(double)) return -1;
+    if (*inputs < 1 || *outputs < 1 || rows < 0) return -1;
+
+    /* The rows must all be there. */
+    const long long row_bytes = (long long)*real * (*inputs + *outputs);
+    if (rows > (size - GENANN_DATASET_HEADER) / row_bytes) return -1;
+
+    return rows;
+}
+
+
+/* Reads the rows that follow the header into memory, in this build's
+ * genann_real. */
+static int genann_dataset_load(genann_dataset *ds, FILE *in, int real) {
+    const size_t n = (size_t)ds->rows * (ds->inputs + ds->outputs);
+    genann_real *data = malloc(sizeof(genann_real) * (n ? n : 1));
+    if (!data) return -1;
+
+    /* Convert a chunk at a time. */
+    unsigned char raw[8 * 1024];
+    const size_t chunk = sizeof(raw) / real;
+    size_t i, done = 0;
+
+    while (done < n) {
+        const size_t c = n - done < chunk ? n - done : chunk;
+        if (fread(raw, real * c, 1, in) != 1) {
+            free(data);
+            return -1;
+        }
+        if (!genann_dataset_little_endian()) genann_dataset_swap(raw, c, real);
+        for (i = 0; i < c; ++i) {
+            if (real == sizeof(float)) {
+                float f;
+                memcpy(&f, raw + i * real, real);
+                data[done + i] = f;
+            } else {
+                double d;
+                memcpy(&d, raw + i * real, real);
+                data[done + i] = d;
+            }
+        }
+        done += c;
+    }
+
+    ds->input = data;
+    ds->output = data + (size_t)ds->rows * ds->inputs;
+    ds->mapping = data;
+    ds->mapping_size = 0;
+    return 0;
+}
+
+
+genann_dataset *genann_dataset_open(const char *path) {
+    genann_dataset *ds = malloc(sizeof(genann_dataset));
+    if (!ds) return NULL;
+
+    unsigned char header[GENANN_DATASET_HEADER];
+    int real;
+
+#ifdef GENANN_MMAP
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        free(ds);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size < GENANN_DATASET_HEADER
+            || pread(fd, header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+        close(fd);
+        free(ds);
+        return NULL;
+    }
+
+    ds->rows = genann_dataset_check(header, st.st_size, &real, &ds->inputs, &ds->outputs);
+    if (ds->rows < 0) {
+        close(fd);
+        free(ds);
+        return NULL;
+    }
+
+    /* Rows in this build's format are used straight from the page cache. */
+    if (real == sizeof(genann_real) && genann_dataset_little_endian()) {
+        void *map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+            free(ds);
+            return NULL;
+        }
+
+        ds->input = (genann_real const*)((char const*)map + GENANN_DATASET_HEADER);
+        ds->output = ds->input + (size_t)ds->rows * ds->inputs;
+        ds->mapping = map;
+        ds->mapping_size = st.st_size;
+        return ds;
+    }
+
+    close(fd);
+#endif
+
+    FILE *in = fopen(path, "rb");
+    if (!in) {
+        free(ds);
+        return NULL;
+    }
+
+    long long size = -1;
+    if (fread(header, sizeof(header), 1, in) == 1 && !fseek(in, 0, SEEK_END)) {
+        size = ftell(in);
+    }
+
+    ds->rows = size < 0 ? -1 : genann_dataset_check(header, size, &real, &ds->inputs, &ds->outputs);
+    if (ds->rows < 0 || fseek(in, GENANN_DATASET_HEADER, SEEK_SET) || genann_dataset_load(ds, in, real)) {
+        fclose(in);
+        free(ds);
+        return NULL;
+    }
+
+    fclose(in);
+    return ds;
+}
+
+
+void genann_dataset_close(genann_dataset *ds) {
+    if (!ds) return;
+
+#ifdef GENANN_MMAP
+    if (ds->mapping_size) munmap(ds->mapping, ds->mapping_size);
+    else free(ds->mapping);
+#else
+    free(ds->mapping);
+#endif
+
+    free(ds);
+}
+
+
+genann_real const *genann_dataset_input(genann_dataset const *ds, long long row) {
+    return ds->input + row * ds->inputs;
+}
+
+
+genann_real const *genann_dataset_output(genann_dataset const *ds, long long row) {
+    return ds->output + row * ds->outputs;
+}
@@ -0,0 +1,92 @@
+/*
+ * GENANN - Minimal C Artificial Neural Network
+ *
+ * Copyright (c) 2015-2018 Lewis Van Winkle
+ *
+ * http://CodePlea.com
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ */
+
+
+
+#ifndef GENANN_DATASET_H
+#define GENANN_DATASET_H
+
+#include "genann.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A training set of rows of inputs and desired outputs, loaded from a file
+ * written by genann_dataset_write or genann_dataset_convert_csv. All inputs
+ * are stored first and all outputs after them, each row-major, so any run of
+ * rows can be passed straight to genann_run_batch or genann_train_batch. */
+typedef struct genann_dataset {
+    /* Values per row in input and output. */
+    int inputs, outputs;
+
+    /* Number of rows. */
+    long long rows;
+
+    /* All inputs (rows * inputs long). */
+    genann_real const *input;
+
+    /* All desired outputs (rows * outputs long). */
+    genann_real const *output;
+
+    /* The file mapping holding the above, or the buffer they were read into
+     * if mapping_size is 0. */
+    void *mapping;
+    size_t mapping_size;
+
+} genann_dataset;
+
+
+/* Opens a dataset file. On POSIX systems, a file in this build's genann_real
+ * type is mapped into memory rather than read, so opening takes the same
+ * time whatever its size. Other files are read and converted. Returns NULL
+ * on error. */
+genann_dataset *genann_dataset_open(const char *path);
+
+/* Closes a dataset, after which its rows must no longer be used. */
+void genann_dataset_close(genann_dataset *ds);
+
+/* Returns the inputs or desired outputs of one row. */
+genann_real const *genann_dataset_input(genann_dataset const *ds, long long row);
+genann_real const *genann_dataset_output(genann_dataset const *ds, long long row);
+
+/* Writes a dataset of rows rows, packed as for genann_run_batch. Returns 0
+ * on success or -1 on error. */
+int genann_dataset_write(FILE *out, int inputs, int outputs, long long rows,
+        genann_real const *input, genann_real const *output);
+
+/* Converts comma separated text to a dataset file, one row per line: inputs
+ * values, then outputs values. The outputs may instead be a single class
+ * name, which becomes a one-hot row, classes numbered in order of first
+ * appearance. Blank lines and a header line are skipped. The output file
+ * must be seekable. Returns the number of rows written, or -1 on error. */
+long long genann_dataset_convert_csv(FILE *csv, FILE *out, int inputs, int outputs);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*GENANN_DATASET_H*/
@@ -0,0 +1,304 @@
+/*
+ * GENANN - Minimal C Artificial Neural Network
+ *
+ * Copyright (c) 2015-2018 Lewis Van Winkle
+ *
+ * http://CodePlea.com
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ */
+
+#include "genann_evolve.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* SplitMix64. Each child of each generation gets its own stream, seeded
+ * from the population's seed, so breeding can run on any thread. */
+static uint64_t genann_evolve_rand(uint64_t *s) {
+    uint64_t z = (*s += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+
+/* Returns a uniform random number in [0, 1). */
+static double genann_evolve_uniform(uint64_t *s) {
+    return (genann_evolve_rand(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+static uint64_t genann_evolve_stream(genann_population const *pop, int child) {
+    return pop->seed ^ (uint64_t)(pop->generation + 1) * 0xd1b54a32d192ed03ull
+        ^ (uint64_t)child * 0x8cb92ba72f3d8dd7ull;
+}
+
+
+genann_population *genann_population_init(genann const *ann, int size, unsigned long long seed) {
+    if (size < 1) return 0;
+
+    const size_t weights = (size_t)size * ann->total_weights;
+
+    /* Allocate extra size for fitness, both weight matrices and ranks. */
+    const size_t bytes = sizeof(genann_population) + sizeof(double) * size
+        + sizeof(genann_real) * 2 * weights + sizeof(int) * size;
+    genann_population *pop = malloc(bytes);
+    if (!pop) return 0;
+
+    pop->ann = genann_copy(ann);
+    if (!pop->ann) {
+        free(pop);
+        return 0;
+    }
+
+    pop->size = size;
+    pop->total_weights = ann->total_weights;
+    pop->elite = size / 10 > 1 ? size / 10 : 1;
+    pop->tournament = 3;
+    pop->crossover_rate = .7;
+    pop->mutation_rate = .05;
+    pop->mutation_scale = .5;
+    pop->generation = 0;
+    pop->best = 0;
+    pop->thread_ann = 0;
+    pop->threads = 0;
+    pop->seed = seed;
+
+    /* Set pointers. */
+    pop->fitness = (double*)((char*)pop + sizeof(genann_population));
+    pop->weight = (genann_real*)(pop->fitness + size);
+    pop->next = pop->weight + weights;
+    pop->rank = (int*)(pop->next + weights);
+
+    /* The first individual is ann itself; the rest are random, as from
+     * genann_randomize. */
+    uint64_t s = seed;
+    size_t i;
+    memcpy(pop->weight, ann->weight, sizeof(genann_real) * ann->total_weights);
+    for (i = ann->total_weights; i < weights; ++i) {
+        pop->weight[i] = genann_evolve_uniform(&s) - 0.5;
+    }
+    for (i = 0; i < (size_t)size; ++i) pop->fitness[i] = 0;
+
+    return pop;
+}
+
+
+void genann_population_free(genann_population *pop) {
+    int i;
+    for (i = 0; i < pop->threads; ++i) genann_free(pop->thread_ann[i]);
+    free(pop->thread_ann);
+    genann_free(pop->ann);
+    free(pop);
+}
+
+
+/* Makes sure there is an ann for each of the given number of threads. */
+static int genann_population_threads(genann_population *pop, int threads) {
+    if (threads <= pop->threads) return 0;
+
+    genann **a = realloc(pop->thread_ann, sizeof(genann*) * threads);
+    if (!a) return -1;
+    pop->thread_ann = a;
+
+    while (pop->threads < threads) {
+        genann *copy = genann_copy(pop->ann);
+        if (!copy) return -1;
+        a[pop->threads++] = copy;
+    }
+
+    return 0;
+}
+
+
+typedef struct {
+    genann_population *pop;
+    genann_fitness fitness;
+    void *user;
+    int next;
+    int threads;
+} genann_evolve_job;
+
+
+/* Evaluates individuals until there are none left. Taking them one at a
+ * time keeps all threads busy when some individuals take longer. */
+static void genann_evaluate_some(void *arg, int thread) {
+    genann_evolve_job *job = arg;
+    genann_population *pop = job->pop;
+    genann *ann = pop->thread_ann[thread];
+    genann_real *own = ann->weight;
+
+    for (;;) {
+        const int i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= pop->size) break;
+
+        ann->weight = pop->weight + (size_t)i * pop->total_weights;
+        const double f = job->fitness(ann, job->user, thread);
+
+        /* NaN ranks below everything. */
+        pop->fitness[i] = f == f ? f : -HUGE_VAL;
+    }
+
+    ann->weight = own;
+}
+
+
+int genann_population_evaluate(genann_population *pop, genann_threadpool *pool, genann_fitness fitness, void *user) {
+    const int threads = pool ? genann_threadpool_threads(pool) : 1;
+    if (genann_population_threads(pop, threads)) return -1;
+
+    genann_evolve_job job = {pop, fitness, user, 0, threads};
+    if (pool) genann_threadpool_run(pool, genann_evaluate_some, &job);
+    else genann_evaluate_some(&job, 0);
+
+    int i;
+    pop->best = 0;
+    for (i = 1; i < pop->size; ++i) {
+        if (pop->fitness[i] > pop->fitness[pop->best]) pop->best = i;
+    }
+
+    return 0;
+}
+
+
+/* Returns whether individual a ranks above b. Ties go to the lower index,
+ * so the ranking is the same however it is sorted. */
+static int genann_fitter(genann_population const *pop, int a, int b) {
+    return pop->fitness[a] > pop->fitness[b] || (pop->fitness[a] == pop->fitness[b] && a < b);
+}
+
+
+/* Shell sort of the individuals, fittest first. */
+static void genann_population_rank(genann_population *pop) {
+    int *rank = pop->rank;
+    int gap, i, j;
+
+    for (i = 0; i < pop->size; ++i) rank[i] = i;
+
+    for (gap = pop->size / 2; gap > 0; gap = gap == 2 ? 1 : gap * 5 / 11) {
+        for (i = gap; i < pop->size; ++i) {
+            const int r = rank[i];
+            for (j = i; j >= gap && genann_fitter(pop, r, rank[j - gap]); j -= gap) {
+                rank[j] = rank[j - gap];
+            }
+            rank[j] = r;
+        }
+    }
+}
+
+
+/* Returns the fittest of pop->tournament individuals picked at random. */
+static genann_real const *genann_tournament(genann_population const *pop, uint64_t *s) {
+    int best = pop->size, k;
+    for (k = 0; k < (pop->tournament > 1 ? pop->tournament : 1); ++k) {
+        const int r = (int)(genann_evolve_uniform(s) * pop->size);
+        if (r < best) best = r;
+    }
+    return pop->weight + (size_t)pop->rank[best] * pop->total_weights;
+}
+
+
+static void genann_breed_child(genann_population const *pop, int child, int elite) {
+    const int n = pop->total_weights;
+    genann_real *w = pop->next + (size_t)child * n;
+
+    if (child < elite) {
+        memcpy(w, pop->weight + (size_t)pop->rank[child] * n, sizeof(genann_real) * n);
+        return;
+    }
+
+    uint64_t s = genann_evolve_stream(pop, child);
+    genann_real const *a = genann_tournament(pop, &s);
+
+    if (genann_evolve_uniform(&s) < pop->crossover_rate) {
+        /* Each neuron's bias and weights come from one parent or the other. */
+        genann_real const *b = genann_tournament(pop, &s);
+        genann const *ann = pop->ann;
+        int l, j, k = 0;
+
+        for (l = 1; l <= ann->layers; ++l) {
+            const int row = ann->layer_size[l-1] + 1;
+            for (j = 0; j < ann->layer_size[l]; ++j, k += row) {
+                genann_real const *p = genann_evolve_rand(&s) >> 63 ? b : a;
+                memcpy(w + k, p + k, sizeof(genann_real) * row);
+            }
+        }
+    } else {
+        memcpy(w, a, sizeof(genann_real) * n);
+    }
+
+    /* Jump straight from one mutated weight to the next, with geometrically
+     * distributed gaps, so that low rates cost little. A gap past the end is
+     * caught before the cast, since at tiny rates it may not fit in a long
+     * long. */
+    const double rate = pop->mutation_rate;
+    if (rate <= 0) return;
+
+    const double lq = rate < 1 ? log1p(-rate) : 0;
+    long long k = -1;
+    for (;;) {
+        k += 1;
+        if (rate < 1) {
+            const double skip = log1p(-genann_evolve_uniform(&s)) / lq;
+            if (skip >= n - k) break;
+            k += (long long)skip;
+        }
+        if (k >= n) break;
+        w[k] += (genann_evolve_uniform(&s) * 2 - 1) * pop->mutation_scale;
+    }
+}
+
+
+static void genann_breed_some(void *arg, int thread) {
+    genann_evolve_job *job = arg;
+    genann_population *pop = job->pop;
+    const int elite = pop->elite < 1 ? 1 : pop->elite > pop->size ? pop->size : pop->elite;
+
+    const int first = (int)((long long)pop->size * thread / job->threads);
+    const int last = (int)((long long)pop->size * (thread + 1) / job->threads);
+
+    int c;
+    for (c = first; c < last; ++c) genann_breed_child(pop, c, elite);
+}
+
+
+void genann_population_breed(genann_population *pop, genann_threadpool *pool) {
+    genann_population_rank(pop);
+
+    genann_evolve_job job = {pop, 0, 0, 0, pool ? genann_threadpool_threads(pool) : 1};
+    if (pool) genann_threadpool_run(pool, genann_breed_some, &job);
+    else genann_breed_some(&job, 0);
+
+    genann_real *t = pop->weight;
+    pop->weight = pop->next;
+    pop->next = t;
+
+    /* The old best is kept first, as the fittest of the elite. */
+    pop->best = 0;
+    ++pop->generation;
+}
+
+
+void genann_population_best(genann_population const *pop, genann *ann) {
+    memcpy(ann->weight, pop->weight + (size_t)pop->best * pop->total_weights,
+            sizeof(genann_real) * pop->total_weights);
+}
@@ -0,0 +1,120 @@
+/*
+ * GENANN - Minimal C Artificial Neural Network
+ *
+ * Copyright (c) 2015-2018 Lewis Van Winkle
+ *
+ * http://CodePlea.com
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ */
+
+
+
+#ifndef GENANN_EVOLVE_H
+#define GENANN_EVOLVE_H
+
+#include "genann.h"
+#include "genann_thread.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Returns how good ann is, higher being better. It is called from every
+ * thread of the pool at once, with thread being the caller's index in the
+ * pool; each thread has its own ann, which it may run freely. */
+typedef double (*genann_fitness)(genann const *ann, void *user, int thread);
+
+/* A population of anns of one topology, trained by selection, crossover and
+ * mutation; see genann_population_init. The settings may be changed between
+ * generations. */
+typedef struct genann_population {
+    /* Number of individuals. */
+    int size;
+
+    /* Number of weights in each. */
+    int total_weights;
+
+    /* How many of the fittest individuals are carried over unchanged, at
+     * least 1. Default: size / 10 */
+    int elite;
+
+    /* Each parent is the fittest of this many individuals picked at random.
+     * Default: 3 */
+    int tournament;
+
+    /* Chance that a child mixes two parents, taking each neuron's weights
+     * from one or the other, rather than copying one. Default: 0.7 */
+    double crossover_rate;
+
+    /* Chance that each weight of a child is mutated, and how far: by up to
+     * plus or minus mutation_scale. Defaults: 0.05, 0.5 */
+    double mutation_rate;
+    double mutation_scale;
+
+    /* Number of generations bred so far. */
+    long long generation;
+
+    /* Weights of each individual, one row of total_weights after another
+     * (size * total_weights long). */
+    genann_real *weight;
+
+    /* Fitness of each individual, as of the last genann_population_evaluate. */
+    double *fitness;
+
+    /* Index of the fittest individual. Breeding moves it to the front. */
+    int best;
+
+    /* Scratch: the next generation's weights, individuals ranked by fitness,
+     * the ann being evolved, and one ann per thread for evaluation. */
+    genann_real *next;
+    int *rank;
+    genann *ann;
+    genann **thread_ann;
+    int threads;
+
+    unsigned long long seed;
+
+} genann_population;
+
+/* Creates a population of size anns shaped like ann. The first individual
+ * has ann's weights and the rest are random. The seed fixes every random
+ * choice, so results do not depend on the number of threads. Returns NULL
+ * if out of memory. */
+genann_population *genann_population_init(genann const *ann, int size, unsigned long long seed);
+
+/* Frees a population. */
+void genann_population_free(genann_population *pop);
+
+/* Computes the fitness of every individual, spread across pool (or on the
+ * calling thread if pool is NULL), and updates best. Returns 0 on success or
+ * -1 if out of memory. */
+int genann_population_evaluate(genann_population *pop, genann_threadpool *pool, genann_fitness fitness, void *user);
+
+/* Replaces the population with the next generation, bred from the fitness
+ * of the last evaluation. Doesn't allocate. */
+void genann_population_breed(genann_population *pop, genann_threadpool *pool);
+
+/* Copies the weights of the fittest individual to ann. */
+void genann_population_best(genann_population const *pop, genann *ann);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*GENANN_EVOLVE_H*/
@@ -0,0 +1,236 @@
+/*
+ * GENANN - Minimal C Artificial Neural Network
+ *
+ * Copyright (c) 2015-2018 Lewis Van Winkle
+ *
+ * http://CodePlea.com
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ */
+
+#include "genann_fit.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+
+/* SplitMix64, for the split and the shuffles. */
+static uint64_t genann_fit_rand(uint64_t *s) {
+    uint64_t z = (*s += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+
+/* Fisher-Yates shuffle of n row numbers, in place. */
+static void genann_fit_shuffle(long long *row, long long n, uint64_t *s) {
+    long long i;
+    for (i = n - 1; i > 0; --i) {
+        const long long j = (long long)((genann_fit_rand(s) >> 11) * (1.0 / 9007199254740992.0) * (i + 1));
+        const long long t = row[i];
+        row[i] = row[j];
+        row[j] = t;
+    }
+}
+
+
+static double genann_fit_now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+
+void genann_fit_defaults(genann_fit_options *opt) {
+    opt->max_epochs = 1000;
+    opt->learning_rate = .1;
+    opt->schedule = GENANN_FIT_CONSTANT;
+    opt->decay = .5;
+    opt->step = 100;
+    opt->min_learning_rate = 0;
+    opt->validation = .2;
+    opt->patience = 20;
+    opt->min_delta = 0;
+    opt->target_loss = 0;
+    opt->shuffle = 1;
+    opt->seed = 0;
+    opt->pool = 0;
+    opt->report = 0;
+    opt->user = 0;
+}
+
+
+static double genann_fit_rate(genann_fit_options const *opt, int epoch) {
+    switch (opt->schedule) {
+        case GENANN_FIT_STEP:
+            return opt->learning_rate * pow(opt->decay, epoch / (opt->step > 0 ? opt->step : 1));
+        case GENANN_FIT_COSINE:
+            return opt->min_learning_rate + (opt->learning_rate - opt->min_learning_rate)
+                * (1 + cos(M_PI * epoch / opt->max_epochs)) / 2;
+        default:
+            return opt->learning_rate;
+    }
+}
+
+
+typedef struct {
+    genann_workspace *ws;
+    double loss;
+} genann_fit_thread;
+
+
+typedef struct {
+    genann const *ann;
+    genann_dataset const *ds;
+    long long const *row;
+    long long n;
+    int threads;
+    genann_fit_thread *thread;
+} genann_fit_job;
+
+
+/* Sums the loss over one thread's share of the held-out rows. */
+static void genann_fit_validate(void *arg, int thread) {
+    genann_fit_job *job = arg;
+    genann const *ann = job->ann;
+    genann_workspace *ws = job->thread[thread].ws;
+
+    const long long first = job->n * thread / job->threads;
+    const long long last = job->n * (thread + 1) / job->threads;
+
+    double loss = 0;
+    long long i;
+    int k;
+    for (i = first; i < last; ++i) {
+        genann_real const *o = genann_run_ws(ann, ws, genann_dataset_input(job->ds, job->row[i]));
+        genann_real const *t = genann_dataset_output(job->ds, job->row[i]);
+        for (k = 0; k < ann->outputs; ++k) {
+            const double e = t[k] - o[k];
+            loss += e * e;
+        }
+    }
+
+    job->thread[thread].loss = loss;
+}
+
+
+int genann_fit(genann *ann, genann_dataset const *ds, genann_fit_options const *opt, genann_fit_epoch *best) {
+    genann_fit_options defaults;
+    if (!opt) {
+        genann_fit_defaults(&defaults);
+        opt = &defaults;
+    }
+
+    if (ds->inputs != ann->inputs || ds->outputs != ann->outputs || ds->rows < 1) return -1;
+
+    /* The held-out rows are the last of the first shuffle; at least one row
+     * is left to train on. */
+    const long long rows = ds->rows;
+    long long held = opt->validation > 0 ? (long long)(rows * opt->validation) : 0;
+    if (held > rows - 1) held = rows - 1;
+    const long long train = rows - held;
+
+    const int threads = opt->pool && held ? genann_threadpool_threads(opt->pool) : 1;
+
+    /* Allocate the row order, per thread state and the best weights. */
+    const size_t bytes = sizeof(long long) * rows + sizeof(genann_fit_thread) * threads
+        + sizeof(genann_real) * ann->total_weights;
+    long long *row = malloc(bytes);
+    if (!row) return -1;
+    genann_fit_thread *th = (genann_fit_thread*)(row + rows);
+    genann_real *weight = (genann_real*)(th + threads);
+
+    int t, failed = 0;
+    for (t = 0; t < threads; ++t) {
+        th[t].ws = held ? genann_workspace_init(ann) : 0;
+        if (held && !th[t].ws) failed = 1;
+    }
+
+    uint64_t s = opt->seed;
+    long long i;
+    for (i = 0; i < rows; ++i) row[i] = i;
+    if (held) genann_fit_shuffle(row, rows, &s);
+
+    genann_fit_job job = {ann, ds, row + train, held, threads, th};
+    genann_fit_epoch e, kept;
+    double least = HUGE_VAL;
+    int epoch = 0, since = 0, stop = failed;
+
+    memset(&kept, 0, sizeof(kept));
+
+    while (!stop && epoch < opt->max_epochs) {
+        const double start = genann_fit_now();
+        const double rate = genann_fit_rate(opt, epoch);
+
+        if (opt->shuffle) genann_fit_shuffle(row, train, &s);
+
+        double loss = 0;
+        for (i = 0; i < train; ++i) {
+            loss += genann_train_ex(ann, genann_dataset_input(ds, row[i]),
+                    genann_dataset_output(ds, row[i]), rate);
+        }
+
+        /* Summed in thread order, so the result doesn't depend on timing. */
+        double vloss = NAN;
+        if (held) {
+            if (opt->pool) genann_threadpool_run(opt->pool, genann_fit_validate, &job);
+            else genann_fit_validate(&job, 0);
+            vloss = 0;
+            for (t = 0; t < threads; ++t) vloss += th[t].loss;
+            vloss /= held;
+        }
+
+        e.epoch = ++epoch;
+        e.learning_rate = rate;
+        e.train_loss = loss / train;
+        e.validation_loss = vloss;
+        e.seconds = genann_fit_now() - start;
+        e.rows_per_second = e.seconds > 0 ? train / e.seconds : 0;
+
+        /* NaN never counts as an improvement. */
+        const double m = held ? vloss : e.train_loss;
+        if (m < least - opt->min_delta) {
+            least = m;
+            kept = e;
+            since = 0;
+            memcpy(weight, ann->weight, sizeof(genann_real) * ann->total_weights);
+        } else {
+            ++since;
+        }
+
+        stop = (opt->report && opt->report(&e, opt->user))
+            || m <= opt->target_loss
+            || (opt->patience > 0 && since >= opt->patience);
+    }
+
+    if (kept.epoch) memcpy(ann->weight, weight, sizeof(genann_real) * ann->total_weights);
+    if (best) *best = kept;
+
+    for (t = 0; t < threads; ++t) genann_workspace_free(th[t].ws);
+    free(row);
+
+    return failed ? -1 : epoch;
+}
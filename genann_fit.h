@@ -0,0 +1,134 @@
+/*
+ * GENANN - Minimal C Artificial Neural Network
+ *
+ * Copyright (c) 2015-2018 Lewis Van Winkle
+ *
+ * http://CodePlea.com
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ */
+
+
+
+#ifndef GENANN_FIT_H
+#define GENANN_FIT_H
+
+#include "genann.h"
+#include "genann_dataset.h"
+#include "genann_thread.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Learning rate schedules for genann_fit. */
+enum {
+    /* The same rate every epoch. */
+    GENANN_FIT_CONSTANT,
+
+    /* The rate times decay, every step epochs. */
+    GENANN_FIT_STEP,
+
+    /* The rate falls along a half cosine to min_learning_rate at
+     * max_epochs. */
+    GENANN_FIT_COSINE
+};
+
+/* What happened in one epoch of genann_fit. Losses are the sum of the
+ * squared output errors, averaged over rows. */
+typedef struct genann_fit_epoch {
+    /* Number of the epoch, from 1. */
+    int epoch;
+
+    double learning_rate;
+
+    /* Loss on the training rows, found while training on them. */
+    double train_loss;
+
+    /* Loss on the held-out rows after the epoch, or NaN if none are. */
+    double validation_loss;
+
+    /* Wall-clock time of the epoch, including validation, and the training
+     * rows it went through per second. */
+    double seconds;
+    double rows_per_second;
+
+} genann_fit_epoch;
+
+/* Called after every epoch. Returning nonzero stops training. */
+typedef int (*genann_fit_report)(genann_fit_epoch const *epoch, void *user);
+
+/* Settings for genann_fit. Fill them in with genann_fit_defaults, then
+ * change what you need. */
+typedef struct genann_fit_options {
+    /* Most epochs to train for. Default: 1000 */
+    int max_epochs;
+
+    /* Starting rate, and how it changes; see GENANN_FIT_CONSTANT and the
+     * rest. Defaults: .1, GENANN_FIT_CONSTANT, .5, 100, 0 */
+    double learning_rate;
+    int schedule;
+    double decay;
+    int step;
+    double min_learning_rate;
+
+    /* Fraction of the rows, picked at random, held out to judge training
+     * rather than train on. Default: .2 */
+    double validation;
+
+    /* Training stops once the loss has not improved by more than min_delta
+     * for patience epochs, or falls to target_loss. The loss is on the
+     * held-out rows if there are any, else on the training rows. Patience
+     * 0 never stops early. Defaults: 20, 0, 0 */
+    int patience;
+    double min_delta;
+    double target_loss;
+
+    /* Whether to visit the training rows in a new random order each
+     * epoch. Default: 1 */
+    int shuffle;
+
+    /* Fixes the split and the shuffling. Default: 0 */
+    unsigned long long seed;
+
+    /* Threads to judge the held-out rows with, or NULL for the calling
+     * thread. Default: NULL */
+    genann_threadpool *pool;
+
+    /* Called after each epoch, if set. Default: NULL */
+    genann_fit_report report;
+    void *user;
+
+} genann_fit_options;
+
+/* Sets opt to the defaults. */
+void genann_fit_defaults(genann_fit_options *opt);
+
+/* Trains ann on ds by backpropagation, one row at a time, epoch after
+ * epoch, until one of the stopping rules in opt (or the defaults, if opt is
+ * NULL) is met. Leaves ann with the weights of the epoch that had the least
+ * loss, and writes that epoch to best unless best is NULL. Returns the
+ * number of epochs run, or -1 if the dataset doesn't fit ann or out of
+ * memory. */
+int genann_fit(genann *ann, genann_dataset const *ds, genann_fit_options const *opt, genann_fit_epoch *best);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*GENANN_FIT_H*/
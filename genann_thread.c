@@ -0,0 +1,493 @@
+/*
+ * GENANN - Minimal C Artificial Neural Network
+ *
+ * Copyright (c) 2015-2018 Lewis Van Winkle
+ *
+ * http://CodePlea.com
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ */
+
+
+#include "genann_thread.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Layers with fewer weights than this are computed by one thread of a team;
+ * below it a barrier costs about as much as the layer. */
+#ifndef GENANN_TEAM_MIN_WEIGHTS
+#define GENANN_TEAM_MIN_WEIGHTS 16384
+#endif
+
+/* How many times an idle team worker checks for work before sleeping. */
+#ifndef GENANN_TEAM_SPIN
+#define GENANN_TEAM_SPIN 100000
+#endif
+
+/* Each thread of a team takes a multiple of this many neurons, so that no
+ * two threads write to the same cache line of outputs. */
+#define GENANN_TEAM_BLOCK 16
+
+#if defined(__x86_64__) || defined(__i386__)
+#define genann_pause() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define genann_pause() __asm__ __volatile__("yield")
+#else
+#define genann_pause() ((void)0)
+#endif
+
+
+struct genann_threadpool {
+    int threads;
+    pthread_t *tid;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start, done;
+
+    /* Bumped once per genann_threadpool_run call. */
+    unsigned long generation;
+    int pending;
+    int quit;
+
+    void (*fn)(void *arg, int thread);
+    void *arg;
+
+    /* Per-thread gradient buffers kept between training calls. */
+    genann_real *grad;
+    size_t grad_size;
+};
+
+
+typedef struct {
+    genann_threadpool *pool;
+    int index;
+} genann_worker;
+
+
+static void *genann_worker_main(void *p) {
+    genann_worker *me = p;
+    genann_threadpool *pool = me->pool;
+    const int index = me->index;
+    unsigned long seen = 0;
+
+    free(me);
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->generation == seen && !pool->quit) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->quit) {
+            pthread_mutex_unlock(&pool->lock);
+            return 0;
+        }
+        seen = pool->generation;
+        void (*fn)(void *, int) = pool->fn;
+        void *arg = pool->arg;
+        pthread_mutex_unlock(&pool->lock);
+
+        fn(arg, index);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0) pthread_cond_signal(&pool->done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+
+genann_threadpool *genann_threadpool_init(int threads) {
+    if (threads < 1) return 0;
+
+    genann_threadpool *pool = calloc(1, sizeof(genann_threadpool));
+    if (!pool) return 0;
+
+    pool->tid = malloc(sizeof(pthread_t) * threads);
+    if (!pool->tid) {
+        free(pool);
+        return 0;
+    }
+
+    pthread_mutex_init(&pool->lock, 0);
+    pthread_cond_init(&pool->start, 0);
+    pthread_cond_init(&pool->done, 0);
+
+    /* Thread 0 is the caller; start the rest. */
+    pool->threads = 1;
+    while (pool->threads < threads) {
+        genann_worker *w = malloc(sizeof(genann_worker));
+        if (!w) break;
+        w->pool = pool;
+        w->index = pool->threads;
+        if (pthread_create(pool->tid + pool->threads, 0, genann_worker_main, w)) {
+            free(w);
+            break;
+        }
+        ++pool->threads;
+    }
+
+    if (pool->threads < threads) {
+        genann_threadpool_free(pool);
+        return 0;
+    }
+
+    return pool;
+}
+
+
+void genann_threadpool_free(genann_threadpool *pool) {
+    int i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 1; i < pool->threads; ++i) {
+        pthread_join(pool->tid[i], 0);
+    }
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+
+    free(pool->grad);
+    free(pool->tid);
+    free(pool);
+}
+
+
+int genann_threadpool_threads(genann_threadpool const *pool) {
+    return pool->threads;
+}
+
+
+void genann_threadpool_run(genann_threadpool *pool, void (*fn)(void *arg, int thread), void *arg) {
+    if (pool->threads > 1) {
+        pthread_mutex_lock(&pool->lock);
+        pool->fn = fn;
+        pool->arg = arg;
+        pool->pending = pool->threads - 1;
+        ++pool->generation;
+        pthread_cond_broadcast(&pool->start);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    fn(arg, 0);
+
+    if (pool->threads > 1) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->pending) {
+            pthread_cond_wait(&pool->done, &pool->lock);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+
+typedef struct {
+    genann_threadpool *pool;
+    genann const *ann;
+    genann_real const *inputs;
+    genann_real const *desired_outputs;
+    int n;
+    double rate;
+    int failed;
+} genann_train_job;
+
+
+/* Sums the gradient for one thread's share of the samples. */
+static void genann_train_gradient(void *arg, int thread) {
+    genann_train_job *job = arg;
+    genann const *ann = job->ann;
+    const int threads = job->pool->threads;
+    genann_real *g = job->pool->grad + (size_t)thread * ann->total_weights;
+
+    const int first = (int)((long long)job->n * thread / threads);
+    const int last = (int)((long long)job->n * (thread + 1) / threads);
+
+    memset(g, 0, sizeof(genann_real) * ann->total_weights);
+
+    if (last > first && genann_gradient(ann,
+                job->inputs + (long long)first * ann->inputs,
+                job->desired_outputs + (long long)first * ann->outputs,
+                last - first, g)) {
+        pthread_mutex_lock(&job->pool->lock);
+        job->failed = 1;
+        pthread_mutex_unlock(&job->pool->lock);
+    }
+}
+
+
+/* Reduces one thread's slice of the weights across all gradient buffers,
+ * as a pairwise tree in a fixed order, then applies it. */
+static void genann_train_reduce(void *arg, int thread) {
+    genann_train_job *job = arg;
+    genann const *ann = job->ann;
+    const int threads = job->pool->threads;
+    const size_t stride = ann->total_weights;
+    genann_real *g = job->pool->grad;
+
+    const int first = (int)((long long)ann->total_weights * thread / threads);
+    const int last = (int)((long long)ann->total_weights * (thread + 1) / threads);
+
+    int step, t, i;
+
+    for (step = 1; step < threads; step *= 2) {
+        for (t = 0; t + step < threads; t += 2 * step) {
+            genann_real *a = g + t * stride;
+            genann_real const *b = g + (t + step) * stride;
+            for (i = first; i < last; ++i) a[i] += b[i];
+        }
+    }
+
+    const genann_real rate = job->rate / job->n;
+    for (i = first; i < last; ++i) {
+        ann->weight[i] -= rate * g[i];
+    }
+}
+
+
+int genann_train_batch_mt(genann_threadpool *pool, genann const *ann, genann_real const *inputs,
+        genann_real const *desired_outputs, int n, double learning_rate) {
+    if (n < 1) return 0;
+
+    const size_t size = (size_t)pool->threads * ann->total_weights;
+    if (size > pool->grad_size) {
+        genann_real *grad = realloc(pool->grad, sizeof(genann_real) * size);
+        if (!grad) return -1;
+        pool->grad = grad;
+        pool->grad_size = size;
+    }
+
+    genann_train_job job = {pool, ann, inputs, desired_outputs, n, learning_rate, 0};
+
+    genann_threadpool_run(pool, genann_train_gradient, &job);
+    if (job.failed) return -1;
+
+    genann_threadpool_run(pool, genann_train_reduce, &job);
+    return 0;
+}
+
+
+struct genann_team {
+    int threads;
+    pthread_t *tid;
+
+    /* Bumped to start a run; workers spin on it, then sleep on wake. */
+    unsigned long generation;
+    int sleepers;
+    int quit;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+
+    /* Threads at the barrier, and how many times it has opened. */
+    int arrived;
+    unsigned long phase;
+
+    /* The ann being run, set before each generation. */
+    genann const *ann;
+};
+
+
+typedef struct {
+    genann_team *team;
+    int index;
+} genann_team_worker;
+
+
+/* Spins, yielding now and then in case the team has more threads than
+ * there are cores. */
+static void genann_team_spin(int *spins) {
+    if (++*spins % 1024) genann_pause();
+    else sched_yield();
+}
+
+
+static void genann_team_barrier(genann_team *team) {
+    const unsigned long phase = __atomic_load_n(&team->phase, __ATOMIC_ACQUIRE);
+    int spins = 0;
+
+    if (__atomic_add_fetch(&team->arrived, 1, __ATOMIC_ACQ_REL) == team->threads) {
+        __atomic_store_n(&team->arrived, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&team->phase, phase + 1, __ATOMIC_RELEASE);
+    } else {
+        while (__atomic_load_n(&team->phase, __ATOMIC_ACQUIRE) == phase) {
+            genann_team_spin(&spins);
+        }
+    }
+}
+
+
+/* Computes one thread's share of every layer of team->ann. */
+static void genann_team_work(genann_team *team, int thread) {
+    genann const *ann = team->ann;
+    genann_real const *i = ann->output;
+    genann_real *o = ann->output + ann->inputs;
+    int l;
+
+    /* The caller may free ann as soon as the last barrier opens, so don't
+     * look at it after that. */
+    const int layers = ann->layers;
+
+    for (l = 1; l <= layers; ++l) {
+        const int nin = ann->layer_size[l-1];
+        const int nout = ann->layer_size[l];
+
+        if ((long long)nout * (nin + 1) >= GENANN_TEAM_MIN_WEIGHTS) {
+            const int blocks = (nout + GENANN_TEAM_BLOCK - 1) / GENANN_TEAM_BLOCK;
+            int first = (int)((long long)blocks * thread / team->threads) * GENANN_TEAM_BLOCK;
+            int last = (int)((long long)blocks * (thread + 1) / team->threads) * GENANN_TEAM_BLOCK;
+            if (first > nout) first = nout;
+            if (last > nout) last = nout;
+            if (last > first) genann_run_layer(ann, l, i, o, first, last);
+        } else if (thread == 0) {
+            genann_run_layer(ann, l, i, o, 0, nout);
+        }
+
+        genann_team_barrier(team);
+
+        i = o;
+        o += nout;
+    }
+}
+
+
+static void *genann_team_main(void *p) {
+    genann_team_worker *me = p;
+    genann_team *team = me->team;
+    const int index = me->index;
+    unsigned long seen = 0, generation;
+
+    free(me);
+
+    for (;;) {
+        int spins = 0;
+
+        while ((generation = __atomic_load_n(&team->generation, __ATOMIC_ACQUIRE)) == seen) {
+            if (spins < GENANN_TEAM_SPIN) {
+                genann_team_spin(&spins);
+                continue;
+            }
+
+            /* Announce that we sleep before the last look at generation;
+             * genann_run_team bumps it before looking for sleepers, so one
+             * of us sees the other. */
+            pthread_mutex_lock(&team->lock);
+            __atomic_add_fetch(&team->sleepers, 1, __ATOMIC_SEQ_CST);
+            while (__atomic_load_n(&team->generation, __ATOMIC_SEQ_CST) == seen) {
+                pthread_cond_wait(&team->wake, &team->lock);
+            }
+            __atomic_sub_fetch(&team->sleepers, 1, __ATOMIC_SEQ_CST);
+            pthread_mutex_unlock(&team->lock);
+        }
+
+        seen = generation;
+        if (team->quit) return 0;
+
+        genann_team_work(team, index);
+    }
+}
+
+
+static void genann_team_start(genann_team *team) {
+    __atomic_add_fetch(&team->generation, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&team->sleepers, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&team->lock);
+        pthread_cond_broadcast(&team->wake);
+        pthread_mutex_unlock(&team->lock);
+    }
+}
+
+
+genann_team *genann_team_init(int threads) {
+    if (threads < 1) return 0;
+
+    genann_team *team = calloc(1, sizeof(genann_team));
+    if (!team) return 0;
+
+    team->tid = malloc(sizeof(pthread_t) * threads);
+    if (!team->tid) {
+        free(team);
+        return 0;
+    }
+
+    pthread_mutex_init(&team->lock, 0);
+    pthread_cond_init(&team->wake, 0);
+
+    /* Thread 0 is the caller; start the rest. */
+    team->threads = 1;
+    while (team->threads < threads) {
+        genann_team_worker *w = malloc(sizeof(genann_team_worker));
+        if (!w) break;
+        w->team = team;
+        w->index = team->threads;
+        if (pthread_create(team->tid + team->threads, 0, genann_team_main, w)) {
+            free(w);
+            break;
+        }
+        ++team->threads;
+    }
+
+    if (team->threads < threads) {
+        genann_team_free(team);
+        return 0;
+    }
+
+    return team;
+}
+
+
+void genann_team_free(genann_team *team) {
+    int i;
+
+    team->quit = 1;
+    genann_team_start(team);
+
+    for (i = 1; i < team->threads; ++i) {
+        pthread_join(team->tid[i], 0);
+    }
+
+    pthread_cond_destroy(&team->wake);
+    pthread_mutex_destroy(&team->lock);
+
+    free(team->tid);
+    free(team);
+}
+
+
+genann_real const *genann_run_team(genann_team *team, genann const *ann, genann_real const *inputs) {
+    int l, wide = 0;
+
+    for (l = 1; l <= ann->layers; ++l) {
+        if ((long long)ann->layer_size[l] * (ann->layer_size[l-1] + 1) >= GENANN_TEAM_MIN_WEIGHTS) wide = 1;
+    }
+
+    if (team->threads == 1 || !wide) return genann_run(ann, inputs);
+
+    memcpy(ann->output, inputs, sizeof(genann_real) * ann->inputs);
+    genann_stats_count_run();
+
+    team->ann = ann;
+    genann_team_start(team);
+    genann_team_work(team, 0);
+
+    return ann->output + ann->total_neurons - ann->outputs;
+}
@@ -0,0 +1,83 @@
+/*
+ * GENANN - Minimal C Artificial Neural Network
+ *
+ * Copyright (c) 2015-2018 Lewis Van Winkle
+ *
+ * http://CodePlea.com
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ */
+
+
+
+#ifndef GENANN_THREAD_H
+#define GENANN_THREAD_H
+
+#include "genann.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A fixed team of worker threads. The calling thread always takes part in
+ * the work as thread 0, so a pool of 1 thread starts no extra threads. */
+typedef struct genann_threadpool genann_threadpool;
+
+/* Creates a pool of the given number of threads (including the caller). */
+genann_threadpool *genann_threadpool_init(int threads);
+
+/* Stops the worker threads and frees the pool. */
+void genann_threadpool_free(genann_threadpool *pool);
+
+/* Returns the number of threads in the pool. */
+int genann_threadpool_threads(genann_threadpool const *pool);
+
+/* Calls fn(arg, i) once for every thread index i, in parallel, and returns
+ * when all calls have finished. Not reentrant. */
+void genann_threadpool_run(genann_threadpool *pool, void (*fn)(void *arg, int thread), void *arg);
+
+/* Like genann_train_batch, but the n samples are split across the pool.
+ * Each thread sums the gradient for its share of samples into its own
+ * buffer, and the buffers are combined in a fixed order, so the result
+ * depends only on the data and the number of threads. */
+int genann_train_batch_mt(genann_threadpool *pool, genann const *ann, genann_real const *inputs,
+        genann_real const *desired_outputs, int n, double learning_rate);
+
+/* A team of threads that split each layer of a single genann_run between
+ * them, for low latency on wide networks. Between runs the workers spin for
+ * a while before going to sleep, so back-to-back runs start immediately.
+ * Give it no more threads than there are free cores. */
+typedef struct genann_team genann_team;
+
+/* Creates a team of the given number of threads (including the caller). */
+genann_team *genann_team_init(int threads);
+
+/* Stops the worker threads and frees the team. */
+void genann_team_free(genann_team *team);
+
+/* Like genann_run, but each layer of at least GENANN_TEAM_MIN_WEIGHTS
+ * weights is split across the team, with the threads meeting at a barrier
+ * before the next layer. Networks with no such layer are run serially. Not
+ * reentrant. */
+genann_real const *genann_run_team(genann_team *team, genann const *ann, genann_real const *inputs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*GENANN_THREAD_H*/
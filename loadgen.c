@@ -0,0 +1,222 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "serve.h"
+
+/* Sends random inputs to a model of the serve daemon from a number of
+ * connections at once, each waiting for its reply before sending again,
+ * and prints the throughput and latency percentiles.
+ *
+ * Usage: loadgen [-u path | -p port] [-m model, default 0]
+ *                [-c connections, default 8] [-n requests per connection,
+ *                default 1000] */
+
+static const char *path;
+static int port;
+static int model, requests = 1000;
+
+/* Inputs the model takes, from the reply to an empty request. */
+static uint32_t inputs;
+
+typedef struct {
+    pthread_t thread;
+    double *latency;
+    unsigned seed;
+    int failed;
+} client;
+
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+
+static int read_all(int fd, void *p, size_t n) {
+    while (n) {
+        const ssize_t r = read(fd, p, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        p = (char*)p + r;
+        n -= r;
+    }
+    return 0;
+}
+
+
+static int write_all(int fd, void const *p, size_t n) {
+    while (n) {
+        const ssize_t r = write(fd, p, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        p = (char const*)p + r;
+        n -= r;
+    }
+    return 0;
+}
+
+
+static int connect_server(void) {
+    int fd;
+    if (path) {
+        struct sockaddr_un a;
+        memset(&a, 0, sizeof(a));
+        a.sun_family = AF_UNIX;
+        strncpy(a.sun_path, path, sizeof(a.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr*)&a, sizeof(a))) {
+            close(fd);
+            fd = -1;
+        }
+    } else {
+        struct sockaddr_in a;
+        const int one = 1;
+        memset(&a, 0, sizeof(a));
+        a.sin_family = AF_INET;
+        a.sin_port = htons(port);
+        a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr*)&a, sizeof(a))) {
+            close(fd);
+            fd = -1;
+        }
+        if (fd >= 0) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+
+/* Sends one request and reads the reply, discarding the outputs. Returns
+ * the status, or -1 if the connection failed. */
+static int request(int fd, double const *in, uint32_t n, uint32_t *count) {
+    const uint32_t head[2] = {(uint32_t)model, n};
+    uint32_t reply[2];
+    double out[64];
+
+    if (write_all(fd, head, sizeof(head)) || write_all(fd, in, sizeof(double) * n)
+            || read_all(fd, reply, sizeof(reply))) return -1;
+    *count = reply[1];
+
+    uint32_t left = reply[0] == SERVE_OK ? reply[1] : 0;
+    while (left) {
+        const uint32_t k = left < 64 ? left : 64;
+        if (read_all(fd, out, sizeof(double) * k)) return -1;
+        left -= k;
+    }
+    return (int)reply[0];
+}
+
+
+static void *run_client(void *arg) {
+    client *c = arg;
+    double *in = malloc(sizeof(double) * (inputs ? inputs : 1));
+    uint32_t count;
+    int i, j;
+
+    const int fd = connect_server();
+    c->failed = fd < 0 || !in;
+
+    for (i = 0; i < requests && !c->failed; ++i) {
+        for (j = 0; j < (int)inputs; ++j) in[j] = (double)rand_r(&c->seed) / RAND_MAX;
+        const double start = now();
+        if (request(fd, in, inputs, &count) != SERVE_OK) c->failed = 1;
+        c->latency[i] = now() - start;
+    }
+
+    if (fd >= 0) close(fd);
+    free(in);
+    return 0;
+}
+
+
+static int compare(void const *a, void const *b) {
+    const double x = *(double const*)a, y = *(double const*)b;
+    return (x > y) - (x < y);
+}
+
+
+int main(int argc, char *argv[])
+{
+    int connections = 8, i;
+
+    for (i = 1; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+        switch (argv[i][1]) {
+            case 'u': path = argv[i+1]; break;
+            case 'p': port = atoi(argv[i+1]); break;
+            case 'm': model = atoi(argv[i+1]); break;
+            case 'c': connections = atoi(argv[i+1]); break;
+            case 'n': requests = atoi(argv[i+1]); break;
+            default: i = argc; break;
+        }
+    }
+
+    if (i != argc || (!path && !port) || connections < 1 || requests < 1) {
+        printf("Usage: %s [-u path | -p port] [-m model] [-c connections] [-n requests per connection]\n", argv[0]);
+        return 1;
+    }
+
+    /* An empty request gets back the number of inputs. */
+    const int fd = connect_server();
+    if (fd < 0) {
+        printf("Could not connect.\n");
+        return 1;
+    }
+    const int status = request(fd, 0, 0, &inputs);
+    close(fd);
+    if (status != SERVE_BAD_INPUTS) {
+        printf("No model %d.\n", model);
+        return 1;
+    }
+
+    client *clients = calloc(connections, sizeof(client));
+    double *latency = malloc(sizeof(double) * connections * requests);
+    if (!clients || !latency) {
+        printf("Out of memory.\n");
+        return 1;
+    }
+
+    const double start = now();
+    for (i = 0; i < connections; ++i) {
+        clients[i].latency = latency + (size_t)i * requests;
+        clients[i].seed = i + 1;
+        if (pthread_create(&clients[i].thread, 0, run_client, clients + i)) {
+            printf("Could not start threads.\n");
+            return 1;
+        }
+    }
+    for (i = 0; i < connections; ++i) pthread_join(clients[i].thread, 0);
+    const double elapsed = now() - start;
+
+    for (i = 0; i < connections; ++i) {
+        if (clients[i].failed) {
+            printf("Connection %d failed.\n", i);
+            return 1;
+        }
+    }
+
+    const size_t total = (size_t)connections * requests;
+    qsort(latency, total, sizeof(double), compare);
+
+    printf("%zu requests of %u inputs over %d connection(s) in %.3f s: %.0f qps, "
+            "p50 %.1f us, p99 %.1f us, max %.1f us\n",
+            total, inputs, connections, elapsed, total / elapsed,
+            latency[total / 2] * 1e6, latency[total * 99 / 100] * 1e6, latency[total - 1] * 1e6);
+
+    free(latency);
+    free(clients);
+    return 0;
+}
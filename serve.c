@@ -0,0 +1,435 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "genann.h"
+#include "genann_thread.h"
+#include "serve.h"
+
+/* Serves anns to other processes on this machine, over a Unix-domain socket
+ * or a loopback TCP port. Requests that arrive close together are run as
+ * one genann_run_batch_ws, split across a thread pool.
+ *
+ * Usage: serve [-u path | -p port] [-l max latency in us, default 500]
+ *              [-b max batch, default 256] [-t threads, default 1] model...
+ *
+ * Each model is a file from genann_write_binary, which is mapped rather
+ * than read, or from genann_write. Models are numbered from 0 in the order
+ * given. The protocol is described in serve.h. */
+
+typedef struct request {
+    genann_real *input, *output;
+    double arrived;
+    int done, status;
+    pthread_cond_t cond;
+    struct request *next;
+} request;
+
+typedef struct {
+    genann *ann;
+
+    /* Requests waiting, oldest first. */
+    request *head, *tail;
+    int waiting;
+
+    /* A batch of inputs and outputs, max_batch rows each. */
+    genann_real *input, *output;
+
+    /* Scratch for genann_run_batch_ws, one per pool thread. */
+    genann_workspace **ws;
+} model;
+
+static model *models;
+static int model_count;
+
+static int max_batch = 256;
+static double max_latency = 500e-6;
+
+static genann_threadpool *pool;
+
+/* The requests in the batch being run, and which parts of it failed. */
+static request **batch;
+static int *failed;
+
+/* Guards the queues and each request's done flag. arrived times its waits
+ * on the monotonic clock, so a change to the system time doesn't stretch or
+ * cut the batching delay. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t arrived;
+
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+
+static int read_all(int fd, void *p, size_t n) {
+    while (n) {
+        const ssize_t r = read(fd, p, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        p = (char*)p + r;
+        n -= r;
+    }
+    return 0;
+}
+
+
+static int write_all(int fd, void const *p, size_t n) {
+    while (n) {
+        const ssize_t r = write(fd, p, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        p = (char const*)p + r;
+        n -= r;
+    }
+    return 0;
+}
+
+
+static genann *load(const char *path) {
+    genann *ann = genann_open_mmap(path);
+    if (ann) return ann;
+
+    FILE *in = fopen(path, "rb");
+    if (!in) return 0;
+    ann = genann_read_binary(in);
+    if (!ann) {
+        rewind(in);
+        ann = genann_read(in);
+    }
+    fclose(in);
+    return ann;
+}
+
+
+typedef struct {
+    model const *m;
+    int n, parts;
+
+    /* Set by each part that fails, one flag per thread. */
+    int *failed;
+} batch_job;
+
+
+static void run_part(void *arg, int thread) {
+    batch_job *job = arg;
+    genann const *ann = job->m->ann;
+    job->failed[thread] = 0;
+    if (thread >= job->parts) return;
+
+    const int first = (int)((long long)job->n * thread / job->parts);
+    const int last = (int)((long long)job->n * (thread + 1) / job->parts);
+    job->failed[thread] = genann_run_batch_ws(ann, job->m->ws[thread],
+            job->m->input + (long long)first * ann->inputs, last - first,
+            job->m->output + (long long)first * ann->outputs) != 0;
+}
+
+
+/* Waits until a model has a full batch, or a request that has waited
+ * max_latency, and runs it. Requests keep queueing while a batch runs, so
+ * batches grow with the load. */
+static void *dispatch(void *unused) {
+    (void)unused;
+
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        model *m = 0;
+        double deadline = 0;
+        int i;
+
+        for (i = 0; i < model_count; ++i) {
+            model *c = models + i;
+            if (!c->waiting) continue;
+            const double d = c->waiting >= max_batch ? 0 : c->head->arrived + max_latency;
+            if (!m || d < deadline) {
+                m = c;
+                deadline = d;
+            }
+        }
+
+        if (!m) {
+            pthread_cond_wait(&arrived, &lock);
+            continue;
+        }
+
+        if (deadline > now()) {
+            struct timespec t;
+            t.tv_sec = (time_t)deadline;
+            t.tv_nsec = (long)((deadline - t.tv_sec) * 1e9);
+            pthread_cond_timedwait(&arrived, &lock, &t);
+            continue;
+        }
+
+        /* Take up to max_batch requests and copy in their inputs. */
+        genann const *ann = m->ann;
+        int n = 0;
+        while (m->head && n < max_batch) {
+            request *r = m->head;
+            m->head = r->next;
+            memcpy(m->input + (long long)n * ann->inputs, r->input, sizeof(genann_real) * ann->inputs);
+            batch[n++] = r;
+        }
+        if (!m->head) m->tail = 0;
+        m->waiting -= n;
+        pthread_mutex_unlock(&lock);
+
+        /* Split it across the pool in blocks of at least 16 rows. */
+        const int threads = genann_threadpool_threads(pool);
+        batch_job job = {m, n, (n + 15) / 16, failed};
+        if (job.parts > threads) job.parts = threads;
+        genann_threadpool_run(pool, run_part, &job);
+
+        /* A failed part fails the whole batch. */
+        int status = SERVE_OK;
+        for (i = 0; i < threads; ++i) {
+            if (failed[i]) status = SERVE_RUN_FAILED;
+        }
+
+        pthread_mutex_lock(&lock);
+        for (i = 0; i < n; ++i) {
+            if (status == SERVE_OK) {
+                memcpy(batch[i]->output, m->output + (long long)i * ann->outputs, sizeof(genann_real) * ann->outputs);
+            }
+            batch[i]->status = status;
+            batch[i]->done = 1;
+            pthread_cond_signal(&batch[i]->cond);
+        }
+    }
+
+    return 0;
+}
+
+
+/* Reads requests from one connection and writes the replies. */
+static void *serve(void *arg) {
+    const int fd = (int)(intptr_t)arg;
+    double *values = 0;
+    genann_real *buffer = 0;
+    size_t capacity = 0;
+
+    request r;
+    pthread_cond_init(&r.cond, 0);
+
+    for (;;) {
+        uint32_t head[2];
+        if (read_all(fd, head, sizeof(head)) || head[1] > SERVE_MAX_INPUTS) break;
+
+        const uint32_t index = head[0], n = head[1];
+        genann const *ann = index < (uint32_t)model_count ? models[index].ann : 0;
+        const size_t need = n + (ann ? ann->outputs : 0);
+
+        if (need > capacity) {
+            double *v = realloc(values, sizeof(double) * need);
+            if (v) values = v;
+            genann_real *b = realloc(buffer, sizeof(genann_real) * need);
+            if (b) buffer = b;
+            if (!v || !b) break;
+            capacity = need;
+        }
+        if (read_all(fd, values, sizeof(double) * n)) break;
+
+        uint32_t reply[2];
+        if (!ann || (int)n != ann->inputs) {
+            reply[0] = ann ? SERVE_BAD_INPUTS : SERVE_BAD_MODEL;
+            reply[1] = ann ? ann->inputs : 0;
+            if (write_all(fd, reply, sizeof(reply))) break;
+            continue;
+        }
+
+        uint32_t i;
+        for (i = 0; i < n; ++i) buffer[i] = values[i];
+
+        r.input = buffer;
+        r.output = buffer + n;
+        r.done = 0;
+        r.next = 0;
+
+        model *m = models + index;
+        pthread_mutex_lock(&lock);
+        r.arrived = now();
+        if (m->tail) m->tail->next = &r;
+        else m->head = &r;
+        m->tail = &r;
+        ++m->waiting;
+        pthread_cond_signal(&arrived);
+        while (!r.done) pthread_cond_wait(&r.cond, &lock);
+        pthread_mutex_unlock(&lock);
+
+        if (r.status != SERVE_OK) {
+            reply[0] = r.status;
+            reply[1] = 0;
+            if (write_all(fd, reply, sizeof(reply))) break;
+            continue;
+        }
+
+        for (i = 0; i < (uint32_t)ann->outputs; ++i) values[i] = r.output[i];
+        reply[0] = SERVE_OK;
+        reply[1] = ann->outputs;
+        if (write_all(fd, reply, sizeof(reply)) || write_all(fd, values, sizeof(double) * ann->outputs)) break;
+    }
+
+    pthread_cond_destroy(&r.cond);
+    free(values);
+    free(buffer);
+    close(fd);
+    return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    const char *path = 0;
+    int port = 0, threads = 1, i;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i += 2) {
+        if (i + 1 >= argc) break;
+        switch (argv[i][1]) {
+            case 'u': path = argv[i+1]; break;
+            case 'p': port = atoi(argv[i+1]); break;
+            case 'l': max_latency = atof(argv[i+1]) * 1e-6; break;
+            case 'b': max_batch = atoi(argv[i+1]); break;
+            case 't': threads = atoi(argv[i+1]); break;
+            default: i = argc; break;
+        }
+    }
+
+    if (i >= argc || (!path && !port) || max_batch < 1 || threads < 1) {
+        printf("Usage: %s [-u path | -p port] [-l max latency in us] [-b max batch] [-t threads] model...\n", argv[0]);
+        return 1;
+    }
+
+    model_count = argc - i;
+    models = calloc(model_count, sizeof(model));
+    batch = malloc(sizeof(request*) * max_batch);
+    failed = calloc(threads, sizeof(int));
+    if (!models || !batch || !failed) {
+        printf("Out of memory.\n");
+        return 1;
+    }
+
+    int j;
+    for (j = 0; j < model_count; ++j) {
+        model *m = models + j;
+        m->ann = load(argv[i + j]);
+        if (!m->ann) {
+            printf("Could not load model: %s\n", argv[i + j]);
+            return 1;
+        }
+        m->input = malloc(sizeof(genann_real) * max_batch * m->ann->inputs);
+        m->output = malloc(sizeof(genann_real) * max_batch * m->ann->outputs);
+        m->ws = calloc(threads, sizeof(genann_workspace*));
+        if (!m->input || !m->output || !m->ws) {
+            printf("Out of memory.\n");
+            return 1;
+        }
+
+        /* Batches then allocate nothing. */
+        int t;
+        for (t = 0; t < threads; ++t) {
+            m->ws[t] = genann_workspace_init_batch(m->ann);
+            if (!m->ws[t]) {
+                printf("Out of memory.\n");
+                return 1;
+            }
+        }
+        printf("Model %d: %s, %d inputs, %d outputs.\n", j, argv[i + j], m->ann->inputs, m->ann->outputs);
+    }
+
+    pthread_condattr_t attr;
+    if (pthread_condattr_init(&attr)
+            || pthread_condattr_setclock(&attr, CLOCK_MONOTONIC)
+            || pthread_cond_init(&arrived, &attr)) {
+        printf("Could not set up the batching clock.\n");
+        return 1;
+    }
+    pthread_condattr_destroy(&attr);
+
+    pool = genann_threadpool_init(threads);
+    if (!pool) {
+        printf("Could not start threads.\n");
+        return 1;
+    }
+
+    int listener;
+    if (path) {
+        struct sockaddr_un a;
+        memset(&a, 0, sizeof(a));
+        a.sun_family = AF_UNIX;
+        if (strlen(path) >= sizeof(a.sun_path)) {
+            printf("Socket path too long: %s\n", path);
+            return 1;
+        }
+        strcpy(a.sun_path, path);
+        unlink(path);
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0 || bind(listener, (struct sockaddr*)&a, sizeof(a))) {
+            printf("Could not bind to %s\n", path);
+            return 1;
+        }
+    } else {
+        struct sockaddr_in a;
+        const int one = 1;
+        memset(&a, 0, sizeof(a));
+        a.sin_family = AF_INET;
+        a.sin_port = htons(port);
+        a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        if (listener >= 0) setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (listener < 0 || bind(listener, (struct sockaddr*)&a, sizeof(a))) {
+            printf("Could not bind to port %d\n", port);
+            return 1;
+        }
+    }
+
+    if (listen(listener, 128)) {
+        printf("Could not listen.\n");
+        return 1;
+    }
+
+    /* A client hanging up mid-reply must not kill the server. */
+    signal(SIGPIPE, SIG_IGN);
+
+    pthread_t t;
+    pthread_attr_t detached;
+    pthread_attr_init(&detached);
+    pthread_attr_setdetachstate(&detached, PTHREAD_CREATE_DETACHED);
+
+    if (pthread_create(&t, &detached, dispatch, 0)) {
+        printf("Could not start threads.\n");
+        return 1;
+    }
+
+    if (path) printf("Serving on %s", path);
+    else printf("Serving on port %d", port);
+    printf(", batches of up to %d within %.0f us, %d thread(s).\n", max_batch, max_latency * 1e6, threads);
+    fflush(stdout);
+
+    for (;;) {
+        const int fd = accept(listener, 0, 0);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("accept");
+            return 1;
+        }
+        if (!path) {
+            const int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        if (pthread_create(&t, &detached, serve, (void*)(intptr_t)fd)) close(fd);
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+/* The protocol of the serve daemon, shared with loadgen.
+ *
+ * It is binary, in this machine's byte order. A request is two 32-bit
+ * values, the model number and the number of inputs, followed by that many
+ * doubles. The reply is a 32-bit status and count, followed by count
+ * doubles: the outputs if the status is SERVE_OK. For SERVE_BAD_INPUTS the
+ * count is the number of inputs the model takes and no values follow, so a
+ * request with no inputs asks a model's size. Other errors have a count of
+ * 0. A connection may send its next request once it has the reply. */
+
+enum {
+    SERVE_OK,
+    SERVE_BAD_INPUTS,
+    SERVE_BAD_MODEL,
+
+    /* The batch holding the request could not be run. */
+    SERVE_RUN_FAILED
+};
+
+/* Longest request accepted, in inputs. */
+#define SERVE_MAX_INPUTS (1 << 20)
+
+#endif /*SERVE_H*/
@@ -24,18 +24,35 @@
  */
 
 #include "genann.h"
+#include "genann_thread.h"
+#include "genann_dataset.h"
+#include "genann_evolve.h"
+#include "genann_fit.h"
 #include "minctest.h"
+#include <limits.h>
 #include <stdio.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 
+/* How closely results that differ only by rounding must agree. */
+#define SINGLE (sizeof(genann_real) < sizeof(double))
+#define REAL_TOLERANCE (SINGLE ? 1e-5 : 1e-12)
+
+/* Whether genann_open_mmap works in this build; see GENANN_MMAP in genann.c. */
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(GENANN_NO_MMAP)
+#define MMAP 1
+#else
+#define MMAP 0
+#endif
+
 
 void basic() {
     genann *ann = genann_init(1, 0, 0, 1);
 
     lequal(ann->total_weights, 2);
-    double a;
+    genann_real a;
 
 
     a = 0;
@@ -89,8 +106,8 @@ void xor() {
     ann->weight[8] = -1;
 
 
-    double input[4][2] = {{0, 0}, {0, 1}, {1, 0}, {1, 1}};
-    double output[4] = {0, 1, 1, 0};
+    genann_real input[4][2] = {{0, 0}, {0, 1}, {1, 0}, {1, 1}};
+    genann_real output[4] = {0, 1, 1, 0};
 
     lfequal(output[0], *genann_run(ann, input[0]));
     lfequal(output[1], *genann_run(ann, input[1]));
@@ -104,22 +121,53 @@ void xor() {
 void backprop() {
     genann *ann = genann_init(1, 0, 0, 1);
 
-    double input, output;
+    genann_real input, output;
     input = .5;
     output = 1;
 
-    double first_try = *genann_run(ann, &input);
+    genann_real first_try = *genann_run(ann, &input);
     genann_train(ann, &input, &output, .5);
-    double second_try = *genann_run(ann, &input);
+    genann_real second_try = *genann_run(ann, &input);
     lok(fabs(first_try - output) > fabs(second_try - output));
 
     genann_free(ann);
 }
 
 
+void train_ex() {
+    genann *ann = genann_init(3, 2, 5, 2);
+    genann *a = genann_copy(ann);
+    genann *b = genann_copy(ann);
+    const genann_real in[3] = {.3, -.2, .9};
+    const genann_real out[2] = {1, 0};
+    int i;
+
+    genann_real const *before = genann_run(ann, in);
+    const double loss = (out[0] - before[0]) * (out[0] - before[0]) + (out[1] - before[1]) * (out[1] - before[1]);
+
+    /* All three do the same update. */
+    genann_train(ann, in, out, .5);
+    lfequal(genann_train_ex(a, in, out, .5), loss);
+    genann_run(b, in);
+    lfequal(genann_backprop_from_last_run(b, out, .5), loss);
+
+    for (i = 0; i < ann->total_weights; ++i) {
+        lok(a->weight[i] == ann->weight[i]);
+        lok(b->weight[i] == ann->weight[i]);
+    }
+
+    /* And the loss goes down. */
+    lok(genann_train_ex(a, in, out, .5) < loss);
+
+    genann_free(ann);
+    genann_free(a);
+    genann_free(b);
+}
+
+
 void train_and() {
-    double input[4][2] = {{0, 0}, {0, 1}, {1, 0}, {1, 1}};
-    double output[4] = {0, 0, 0, 1};
+    genann_real input[4][2] = {{0, 0}, {0, 1}, {1, 0}, {1, 1}};
+    genann_real output[4] = {0, 0, 0, 1};
 
     genann *ann = genann_init(2, 0, 0, 1);
 
@@ -142,8 +190,8 @@ void train_and() {
 
 
 void train_or() {
-    double input[4][2] = {{0, 0}, {0, 1}, {1, 0}, {1, 1}};
-    double output[4] = {0, 1, 1, 1};
+    genann_real input[4][2] = {{0, 0}, {0, 1}, {1, 0}, {1, 1}};
+    genann_real output[4] = {0, 1, 1, 1};
 
     genann *ann = genann_init(2, 0, 0, 1);
     genann_randomize(ann);
@@ -168,8 +216,8 @@ void train_or() {
 
 
 void train_xor() {
-    double input[4][2] = {{0, 0}, {0, 1}, {1, 0}, {1, 1}};
-    double output[4] = {0, 1, 1, 0};
+    genann_real input[4][2] = {{0, 0}, {0, 1}, {1, 0}, {1, 1}};
+    genann_real output[4] = {0, 1, 1, 0};
 
     genann *ann = genann_init(2, 1, 2, 1);
 
@@ -194,8 +242,8 @@ void train_xor() {
 
 
 void train_xor_act(genann_actfun act) {
-    double input[4][2] = {{0, 0}, {0, 1}, {1, 0}, {1, 1}};
-    double output[4] = {0, 1, 1, 0};
+    genann_real input[4][2] = {{0, 0}, {0, 1}, {1, 0}, {1, 1}};
+    genann_real output[4] = {0, 1, 1, 0};
 
     int i, j, r;
     int solved = 0;
@@ -234,18 +282,16 @@ void train_xor_relu() {
 }
 
 
-void gradient_act(genann_actfun hidden, genann_actfun output) {
-    double input[2] = {.3, -.2};
-    double target[1] = {.7};
-    const double eps = 1e-6;
+/* Checks genann_train against a numeric gradient for an ann with 2 inputs
+ * and 1 output, then frees it. */
+void gradient_check(genann *ann) {
+    genann_real input[2] = {.3, -.2};
+    genann_real target[1] = {.7};
+    const double eps = SINGLE ? 1e-3 : 1e-6;
     const double rate = .1;
     double checked = 0;
     int i;
 
-    genann *ann = genann_init(2, 1, 3, 1);
-    ann->activation_hidden = hidden;
-    ann->activation_output = output;
-
     /* Fixed, varied weights keep this test deterministic. */
     for (i = 0; i < ann->total_weights; ++i) {
         ann->weight[i] = sin(i * 1.7) * .5;
@@ -257,7 +303,7 @@ void gradient_act(genann_actfun hidden, genann_actfun output) {
     /* Each weight update must match the central-difference gradient of
      * the squared error E = (target - out)^2 / 2. */
     for (i = 0; i < ann->total_weights; ++i) {
-        const double save = ann->weight[i];
+        const genann_real save = ann->weight[i];
         double o, e1, e2, numeric;
 
         ann->weight[i] = save + eps;
@@ -272,7 +318,7 @@ void gradient_act(genann_actfun hidden, genann_actfun output) {
         numeric = (e1 - e2) / (2 * eps);
         checked += fabs(numeric);
 
-        lok(fabs((trained->weight[i] - save) - (-rate * numeric)) < 1e-7);
+        lok(fabs((trained->weight[i] - save) - (-rate * numeric)) < (SINGLE ? 1e-5 : 1e-7));
     }
 
     /* Guard against passing trivially with an all-zero gradient. */
@@ -283,13 +329,380 @@ void gradient_act(genann_actfun hidden, genann_actfun output) {
 }
 
 
+void gradient_act(genann_activation const *hidden, genann_activation const *output) {
+    genann *ann = genann_init(2, 1, 3, 1);
+    genann_set_activation_hidden(ann, hidden);
+    genann_set_activation_output(ann, output);
+    gradient_check(ann);
+}
+
+
 void gradient_tanh() {
-    gradient_act(genann_act_tanh, genann_act_tanh);
+    gradient_act(&genann_activation_tanh, &genann_activation_tanh);
 }
 
 
 void gradient_relu() {
-    gradient_act(genann_act_relu, genann_act_sigmoid);
+    gradient_act(&genann_activation_relu, &genann_activation_sigmoid);
+}
+
+
+genann_real softsign(const genann *ann, genann_real a) {
+    return a / (1 + fabs(a));
+}
+
+
+genann_real softsign_derivative(const genann *ann, genann_real y) {
+    return (1 - fabs(y)) * (1 - fabs(y));
+}
+
+
+void gradient_custom() {
+    const genann_activation act = {GENANN_ACT_CUSTOM, softsign, softsign_derivative, 0, 0};
+    gradient_act(&act, &act);
+    gradient_act(&genann_activation_linear, &act);
+}
+
+
+void workspace() {
+    genann_real input[3][3] = {{0, .5, 1}, {-1, 2, .25}, {.3, .3, -.7}};
+    genann_real target[2] = {.2, .9};
+    int i, j;
+
+    genann *ann = genann_init(3, 2, 4, 2);
+    genann *copy = genann_copy(ann);
+    genann_workspace *a = genann_workspace_init(ann);
+    genann_workspace *b = genann_workspace_init(ann);
+
+    lequal(a->neurons, ann->total_neurons - ann->inputs);
+
+    /* Interleaved runs don't disturb each other or the ann. */
+    genann_real const *oa = genann_run_ws(ann, a, input[0]);
+    genann_real const *ob = genann_run_ws(ann, b, input[1]);
+    genann_real const *o = genann_run(ann, input[2]);
+
+    for (j = 0; j < 2; ++j) {
+        lok(oa[j] == genann_run(copy, input[0])[j]);
+        lok(ob[j] == genann_run(copy, input[1])[j]);
+        lok(o[j] == genann_run(copy, input[2])[j]);
+    }
+
+    /* Training through a workspace matches genann_train. */
+    genann_train(copy, input[1], target, .3);
+    genann_train_ws(ann, a, input[1], target, .3);
+    for (i = 0; i < ann->total_weights; ++i) {
+        lok(ann->weight[i] == copy->weight[i]);
+    }
+
+    genann_workspace_free(a);
+    genann_workspace_free(b);
+    genann_free(copy);
+    genann_free(ann);
+}
+
+
+void train_batch() {
+    genann_real input[4][2] = {{0, 0}, {0, 1}, {1, 0}, {1, 1}};
+    genann_real output[4] = {0, 1, 1, 0};
+    int i, j;
+
+    genann *ann = genann_init(2, 2, 3, 1);
+    ann->activation_hidden = genann_act_tanh;
+
+    /* A batch of one matches genann_train to within rounding error. */
+    genann *single = genann_copy(ann);
+    genann_train(single, input[1], output + 1, .5);
+    lequal(genann_train_batch(ann, input[1], output + 1, 1, .5), 0);
+    for (i = 0; i < ann->total_weights; ++i) {
+        lok(fabs(ann->weight[i] - single->weight[i]) < REAL_TOLERANCE);
+    }
+
+    /* A larger batch applies the average of the per-sample updates. */
+    genann_real *sum = calloc(ann->total_weights, sizeof(genann_real));
+    for (j = 0; j < 4; ++j) {
+        genann *step = genann_copy(ann);
+        genann_train(step, input[j], output + j, .5);
+        for (i = 0; i < ann->total_weights; ++i) {
+            sum[i] += step->weight[i] - ann->weight[i];
+        }
+        genann_free(step);
+    }
+
+    genann_free(single);
+    single = genann_copy(ann);
+    lequal(genann_train_batch(single, input[0], output, 4, .5), 0);
+    for (i = 0; i < ann->total_weights; ++i) {
+        lok(fabs((single->weight[i] - ann->weight[i]) - sum[i] / 4) < REAL_TOLERANCE);
+    }
+
+    free(sum);
+    genann_free(single);
+    genann_free(ann);
+}
+
+
+void train_batch_xor() {
+    genann_real input[4][2] = {{0, 0}, {0, 1}, {1, 0}, {1, 1}};
+    genann_real output[4] = {0, 1, 1, 0};
+    int i, j, r;
+    int solved = 0;
+
+    for (r = 0; r < 10 && !solved; ++r) {
+        genann *ann = genann_init(2, 1, 4, 1);
+
+        for (i = 0; i < 4000; ++i) {
+            genann_train_batch(ann, input[0], output, 4, 3);
+        }
+
+        solved = 1;
+        for (j = 0; j < 4; ++j) {
+            if ((*genann_run(ann, input[j]) > .5) != (output[j] > .5)) solved = 0;
+        }
+
+        genann_free(ann);
+    }
+
+    lok(solved);
+}
+
+
+void optimizer_first_step() {
+    const double lr = .01, mu = .9, rho = .9;
+    const int types[] = {GENANN_OPT_SGD, GENANN_OPT_MOMENTUM, GENANN_OPT_NESTEROV, GENANN_OPT_RMSPROP, GENANN_OPT_ADAM};
+    int t, i;
+
+    genann *ann = genann_init(3, 1, 4, 2);
+    genann_real *grad = malloc(sizeof(genann_real) * ann->total_weights);
+    for (i = 0; i < ann->total_weights; ++i) grad[i] = sin(i * 1.3) + .05;
+
+    for (t = 0; t < 5; ++t) {
+        genann *a = genann_copy(ann);
+        genann_optimizer *opt = genann_optimizer_init(a, types[t], lr);
+        lequal(genann_optimizer_step(opt, a, grad, 2), 0);
+        lok(opt->steps == 1);
+
+        /* The first step of each rule, for a mean gradient of grad / 2. */
+        for (i = 0; i < ann->total_weights; ++i) {
+            const double g = grad[i] / 2;
+            double expect = -lr * g;
+            if (types[t] == GENANN_OPT_NESTEROV) expect = -lr * (1 + mu) * g;
+            if (types[t] == GENANN_OPT_RMSPROP) expect = -lr * g / (sqrt(1 - rho) * fabs(g) + 1e-8);
+            if (types[t] == GENANN_OPT_ADAM) expect = -lr * g / (fabs(g) + 1e-8);
+            lok(fabs((a->weight[i] - ann->weight[i]) - expect) < REAL_TOLERANCE);
+        }
+
+        genann_optimizer_free(opt);
+        genann_free(a);
+    }
+
+    /* Weight decay shrinks weights on top of the gradient step. */
+    genann *a = genann_copy(ann);
+    genann_optimizer *opt = genann_optimizer_init(a, GENANN_OPT_SGD, lr);
+    opt->weight_decay = .5;
+    genann_optimizer_step(opt, a, grad, 1);
+    for (i = 0; i < ann->total_weights; ++i) {
+        lok(fabs(a->weight[i] - (ann->weight[i] * (1 - lr * .5) - lr * grad[i])) < REAL_TOLERANCE);
+    }
+
+    /* An empty batch has no mean gradient to apply. */
+    genann *before = genann_copy(a);
+    lequal(genann_optimizer_step(opt, a, grad, 0), -1);
+    lequal(genann_optimizer_step(opt, a, grad, -3), -1);
+    lok(opt->steps == 1);
+    for (i = 0; i < ann->total_weights; ++i) lfequal(a->weight[i], before->weight[i]);
+    genann_free(before);
+    genann_optimizer_free(opt);
+    genann_free(a);
+
+    lok(genann_optimizer_init(ann, 99, lr) == NULL);
+
+    free(grad);
+    genann_free(ann);
+}
+
+
+void optimizer_xor() {
+    genann_real input[4][2] = {{0, 0}, {0, 1}, {1, 0}, {1, 1}};
+    genann_real output[4] = {0, 1, 1, 0};
+    const int types[] = {GENANN_OPT_MOMENTUM, GENANN_OPT_NESTEROV, GENANN_OPT_RMSPROP, GENANN_OPT_ADAM};
+    const double rates[] = {1, 1, .05, .05};
+    int t, i, j, r;
+
+    /* Each solves in a tenth of the steps train_batch_xor allows. */
+    for (t = 0; t < 4; ++t) {
+        int solved = 0;
+
+        for (r = 0; r < 10 && !solved; ++r) {
+            genann *ann = genann_init(2, 1, 4, 1);
+            genann_optimizer *opt = genann_optimizer_init(ann, types[t], rates[t]);
+
+            for (i = 0; i < 400; ++i) {
+                genann_train_opt(ann, opt, input[0], output, 4);
+            }
+
+            solved = 1;
+            for (j = 0; j < 4; ++j) {
+                if ((*genann_run(ann, input[j]) > .5) != (output[j] > .5)) solved = 0;
+            }
+
+            genann_optimizer_free(opt);
+            genann_free(ann);
+        }
+
+        lok(solved);
+    }
+}
+
+
+void train_threads() {
+    const int n = 50;
+    int i, t;
+
+    genann *ann = genann_init(5, 2, 6, 3);
+    genann_real *inputs = malloc(sizeof(genann_real) * n * ann->inputs);
+    genann_real *targets = malloc(sizeof(genann_real) * n * ann->outputs);
+    for (i = 0; i < n * ann->inputs; ++i) inputs[i] = GENANN_RANDOM() * 2 - 1;
+    for (i = 0; i < n * ann->outputs; ++i) targets[i] = GENANN_RANDOM();
+
+    genann *serial = genann_copy(ann);
+    genann_train_batch(serial, inputs, targets, n, .7);
+
+    for (t = 1; t <= 4; ++t) {
+        genann_threadpool *pool = genann_threadpool_init(t);
+        lequal(genann_threadpool_threads(pool), t);
+
+        genann *a = genann_copy(ann);
+        genann *b = genann_copy(ann);
+        lequal(genann_train_batch_mt(pool, a, inputs, targets, n, .7), 0);
+        lequal(genann_train_batch_mt(pool, b, inputs, targets, n, .7), 0);
+
+        for (i = 0; i < ann->total_weights; ++i) {
+            /* Reproducible for a given thread count. */
+            lok(a->weight[i] == b->weight[i]);
+            lok(fabs(a->weight[i] - serial->weight[i]) < REAL_TOLERANCE);
+            if (t == 1) lok(a->weight[i] == serial->weight[i]);
+        }
+
+        genann_free(a);
+        genann_free(b);
+        genann_threadpool_free(pool);
+    }
+
+    free(inputs);
+    free(targets);
+    genann_free(serial);
+    genann_free(ann);
+}
+
+
+void run_team() {
+    const int topo[][4] = {{2, 1, 3, 1}, {64, 2, 300, 10}, {500, 0, 0, 40}};
+    genann_real inputs[502]; /* Runs start at offsets 0 to 2. */
+    int t, n, i, j;
+
+    for (i = 0; i < 502; ++i) inputs[i] = GENANN_RANDOM() * 2 - 1;
+
+    for (t = 1; t <= 4; ++t) {
+        genann_team *team = genann_team_init(t);
+
+        for (n = 0; n < 3; ++n) {
+            genann *ann = genann_init(topo[n][0], topo[n][1], topo[n][2], topo[n][3]);
+
+            /* Several runs, to reuse the team between generations. */
+            for (i = 0; i < 3; ++i) {
+                genann_real expected[40];
+                memcpy(expected, genann_run(ann, inputs + i), sizeof(genann_real) * ann->outputs);
+
+                genann_real const *out = genann_run_team(team, ann, inputs + i);
+                lok(out == ann->output + ann->total_neurons - ann->outputs);
+                for (j = 0; j < ann->outputs; ++j) {
+                    lok(fabs(out[j] - expected[j]) < REAL_TOLERANCE);
+                }
+            }
+
+            genann_free(ann);
+        }
+
+        genann_team_free(team);
+    }
+}
+
+
+static double xor_fitness(genann const *ann, void *user, int thread) {
+    const genann_real input[4][2] = {{0, 0}, {0, 1}, {1, 0}, {1, 1}};
+    const genann_real output[4] = {0, 1, 1, 0};
+    double err = 0;
+    int i;
+
+    (void)user;
+    (void)thread;
+
+    for (i = 0; i < 4; ++i) {
+        const double d = *genann_run(ann, input[i]) - output[i];
+        err += d * d;
+    }
+    return -err;
+}
+
+
+void evolve() {
+    genann *ann = genann_init(2, 1, 3, 1);
+    genann_threadpool *pool = genann_threadpool_init(3);
+    genann_population *serial = genann_population_init(ann, 60, 42);
+    genann_population *parallel = genann_population_init(ann, 60, 42);
+    int g, i;
+
+    lfequal(serial->weight[5], ann->weight[5]);
+    lok(serial->weight[ann->total_weights + 5] != ann->weight[5]);
+
+    double last = -HUGE_VAL;
+    for (g = 0; g < 400; ++g) {
+        lequal(genann_population_evaluate(serial, 0, xor_fitness, 0), 0);
+        lequal(genann_population_evaluate(parallel, pool, xor_fitness, 0), 0);
+
+        /* The elite never gets worse. */
+        const double best = serial->fitness[serial->best];
+        lok(best >= last);
+        last = best;
+
+        genann_population_breed(serial, 0);
+        genann_population_breed(parallel, pool);
+    }
+
+    lequal((int)serial->generation, 400);
+
+    /* Threads don't change the outcome. */
+    for (i = 0; i < serial->size * serial->total_weights; ++i) {
+        lok(serial->weight[i] == parallel->weight[i]);
+    }
+
+    genann_population_evaluate(serial, 0, xor_fitness, 0);
+    lok(serial->fitness[serial->best] > -.01);
+
+    genann_population_best(serial, ann);
+    lok(xor_fitness(ann, 0, 0) > -.01);
+
+    genann_population_free(serial);
+    genann_population_free(parallel);
+
+    /* At a vanishing mutation rate the gaps between mutations are far
+     * longer than the network, so clones of one individual stay clones. */
+    genann_population *still = genann_population_init(ann, 20, 7);
+    still->crossover_rate = 0;
+    still->mutation_rate = 1e-300;
+    for (i = 1; i < still->size; ++i) {
+        memcpy(still->weight + (size_t)i * still->total_weights, still->weight,
+                sizeof(genann_real) * still->total_weights);
+    }
+    lequal(genann_population_evaluate(still, 0, xor_fitness, 0), 0);
+    genann_population_breed(still, pool);
+    for (i = 0; i < still->size * still->total_weights; ++i) {
+        lok(still->weight[i] == still->weight[i % still->total_weights]);
+    }
+
+    genann_population_free(still);
+    genann_threadpool_free(pool);
+    genann_free(ann);
 }
 
 
@@ -321,6 +734,463 @@ void persist() {
 }
 
 
+void persist_binary() {
+    genann *first = genann_init(1000, 5, 50, 10);
+    first->activation_hidden = genann_act_relu;
+    first->activation_output = genann_act_linear;
+
+    FILE *out = fopen("persist.bin", "wb");
+    lequal(genann_write_binary(first, out), 0);
+    long size = ftell(out);
+    fclose(out);
+
+    lok(size == 64 + (long)sizeof(genann_real) * first->total_weights);
+
+    FILE *in = fopen("persist.bin", "rb");
+    genann *second = genann_read_binary(in);
+    fclose(in);
+
+    lequal(first->inputs, second->inputs);
+    lequal(first->hidden_layers, second->hidden_layers);
+    lequal(first->hidden, second->hidden);
+    lequal(first->outputs, second->outputs);
+    lequal(first->total_weights, second->total_weights);
+    lok(second->activation_hidden == genann_act_relu);
+    lok(second->activation_output == genann_act_linear);
+
+    int i;
+    for (i = 0; i < first->total_weights; ++i) {
+        lok(first->weight[i] == second->weight[i]);
+    }
+
+    genann_free(second);
+
+    /* A damaged weight must be caught by the checksum. */
+    FILE *f = fopen("persist.bin", "r+b");
+    fseek(f, 64 + 3 * sizeof(genann_real), SEEK_SET);
+    int c = fgetc(f);
+    fseek(f, 64 + 3 * sizeof(genann_real), SEEK_SET);
+    fputc(c ^ 0xff, f);
+    fclose(f);
+
+    in = fopen("persist.bin", "rb");
+    lok(genann_read_binary(in) == NULL);
+    fclose(in);
+
+    /* As must a text file. */
+    out = fopen("persist.txt", "w");
+    genann_write(first, out);
+    fclose(out);
+
+    in = fopen("persist.txt", "rb");
+    lok(genann_read_binary(in) == NULL);
+    fclose(in);
+
+    genann_free(first);
+}
+
+
+void persist_mmap() {
+    genann *first = genann_init(30, 2, 20, 4);
+    first->activation_hidden = genann_act_tanh;
+    genann_real input[30];
+    int i;
+
+    for (i = 0; i < 30; ++i) input[i] = GENANN_RANDOM();
+
+    FILE *out = fopen("persist.bin", "wb");
+    genann_write_binary(first, out);
+    fclose(out);
+
+    /* Builds without mmap support always return NULL. */
+    genann *mapped = genann_open_mmap("persist.bin");
+    lok((mapped != NULL) == MMAP);
+    if (!mapped) {
+        genann_free(first);
+        return;
+    }
+
+    lequal(mapped->total_weights, first->total_weights);
+    lok(mapped->activation_hidden == genann_act_tanh);
+
+    for (i = 0; i < first->total_weights; ++i) {
+        lok(first->weight[i] == mapped->weight[i]);
+    }
+
+    genann_real const *expect = genann_run(first, input);
+    genann_real const *got = genann_run(mapped, input);
+    for (i = 0; i < 4; ++i) lok(expect[i] == got[i]);
+
+    /* A copy owns its weights and can be trained. */
+    genann *copy = genann_copy(mapped);
+    genann_free(mapped);
+    genann_train(copy, input, expect, .1);
+    for (i = 0; i < first->total_weights; ++i) {
+        lok(fabs(first->weight[i] - copy->weight[i]) < .1);
+    }
+
+    lok(genann_open_mmap("persist.txt") == NULL);
+
+    genann_free(copy);
+    genann_free(first);
+}
+
+
+void layers() {
+    const int sizes[] = {3, 7, 2, 4};
+    genann_real input[5 * 3], output[5 * 4];
+    int i, j;
+
+    genann *ann = genann_init_layers(4, sizes);
+    lequal(ann->layers, 3);
+    lequal(ann->hidden_layers, 2);
+    lequal(ann->hidden, 7);
+    lequal(ann->total_weights, 4 * 7 + 8 * 2 + 3 * 4);
+    lequal(ann->total_neurons, 16);
+    lequal(ann->weight_offset[2], 28);
+    lequal(ann->weight_offset[3], 44);
+    lequal(ann->neuron_offset[3], 12);
+
+    genann_set_activation_layer(ann, 1, &genann_activation_tanh);
+    genann_set_activation_layer(ann, 2, &genann_activation_relu);
+
+    for (i = 0; i < 5 * 3; ++i) input[i] = sin(i * .9);
+
+    lequal(genann_run_batch(ann, input, 5, output), 0);
+    for (i = 0; i < 5; ++i) {
+        genann_real const *o = genann_run(ann, input + i * 3);
+        for (j = 0; j < 4; ++j) lok(fabs(o[j] - output[i * 4 + j]) < REAL_TOLERANCE);
+    }
+
+    /* Copies and binary files keep the widths and activations. */
+    genann *copy = genann_copy(ann);
+    FILE *out = fopen("persist.bin", "wb");
+    lequal(genann_write_binary(ann, out), 0);
+    fclose(out);
+    FILE *in = fopen("persist.bin", "rb");
+    genann *bin = genann_read_binary(in);
+    fclose(in);
+    genann *mapped = genann_open_mmap("persist.bin");
+
+    genann *loaded[] = {copy, bin, mapped};
+    int k;
+    for (k = 0; k < 3; ++k) {
+        lok(loaded[k] != NULL || (k == 2 && !MMAP));
+        if (!loaded[k]) continue;
+        lequal(loaded[k]->layers, 3);
+        for (i = 0; i <= 3; ++i) lequal(loaded[k]->layer_size[i], sizes[i]);
+        lok(loaded[k]->layer_activation[1] == &genann_activation_tanh);
+        lok(loaded[k]->layer_activation[2] == &genann_activation_relu);
+        genann_real const *a = genann_run(ann, input);
+        genann_real const *b = genann_run(loaded[k], input);
+        for (j = 0; j < 4; ++j) lok(a[j] == b[j]);
+        genann_free(loaded[k]);
+    }
+
+    /* Text files keep the widths and weights. */
+    out = fopen("persist.txt", "w");
+    genann_write(ann, out);
+    fclose(out);
+    in = fopen("persist.txt", "r");
+    genann *text = genann_read(in);
+    fclose(in);
+    lok(text != NULL);
+    lequal(text->total_weights, ann->total_weights);
+    for (i = 0; i <= 3; ++i) lequal(text->layer_size[i], sizes[i]);
+    for (i = 0; i < ann->total_weights; ++i) lfequal(text->weight[i], ann->weight[i]);
+    genann_free(text);
+
+    /* A layer count too large to negate is rejected. */
+    out = fopen("persist.txt", "w");
+    fprintf(out, "%d 2 3", INT_MIN);
+    fclose(out);
+    in = fopen("persist.txt", "r");
+    lok(genann_read(in) == NULL);
+    fclose(in);
+
+    genann_free(ann);
+
+    /* Equal widths give the same network as genann_init. */
+    const int uniform[] = {3, 5, 5, 2};
+    genann *a = genann_init_layers(4, uniform);
+    genann *b = genann_init(3, 2, 5, 2);
+    lequal(a->total_weights, b->total_weights);
+    for (i = 0; i < a->total_weights; ++i) b->weight[i] = a->weight[i];
+    genann_real const *oa = genann_run(a, input);
+    genann_real const *ob = genann_run(b, input);
+    for (j = 0; j < 2; ++j) lok(oa[j] == ob[j]);
+    genann_free(a);
+    genann_free(b);
+
+    const int bad[] = {3, 0, 2};
+    lok(genann_init_layers(3, bad) == NULL);
+    lok(genann_init_layers(1, sizes) == NULL);
+
+    /* Backprop through layers of differing widths and activations. */
+    const int tapered[] = {2, 6, 3, 1};
+    genann *t = genann_init_layers(4, tapered);
+    genann_set_activation_layer(t, 1, &genann_activation_tanh);
+    genann_set_activation_layer(t, 2, &genann_activation_sigmoid);
+    genann_set_activation_layer(t, 3, &genann_activation_linear);
+
+    /* The batch gradient agrees with backprop. */
+    const genann_real x[2] = {.5, -.1}, y[1] = {.3};
+    genann *u = genann_copy(t), *v = genann_copy(t);
+    genann_train(u, x, y, .5);
+    lequal(genann_train_batch(v, x, y, 1, .5), 0);
+    for (i = 0; i < t->total_weights; ++i) lok(fabs(u->weight[i] - v->weight[i]) < REAL_TOLERANCE);
+    genann_free(u);
+    genann_free(v);
+
+    gradient_check(t);
+}
+
+
+void dataset() {
+    FILE *f = fopen("persist.csv", "w");
+    fprintf(f, "a,b,class\n");
+    fprintf(f, "0.5, 1e-3,yes\n");
+    fprintf(f, "\n");
+    fprintf(f, "-2,7,no\r\n");
+    fprintf(f, "3,4,yes");
+    fclose(f);
+
+    FILE *in = fopen("persist.csv", "r");
+    FILE *out = fopen("persist.ds", "wb");
+    lequal((int)genann_dataset_convert_csv(in, out, 2, 2), 3);
+    fclose(in);
+    fclose(out);
+
+    genann_dataset *ds = genann_dataset_open("persist.ds");
+    lok(ds != NULL);
+    lequal(ds->inputs, 2);
+    lequal(ds->outputs, 2);
+    lequal((int)ds->rows, 3);
+
+    const genann_real input[] = {.5, 1e-3, -2, 7, 3, 4};
+    const genann_real output[] = {1, 0, 0, 1, 1, 0};
+    int i;
+    for (i = 0; i < 6; ++i) {
+        lok(ds->input[i] == input[i]);
+        lok(ds->output[i] == output[i]);
+    }
+    lok(genann_dataset_input(ds, 2) == ds->input + 4);
+    lok(genann_dataset_output(ds, 1)[1] == 1);
+
+    /* Rows go straight to the batch functions. */
+    genann *ann = genann_init(2, 1, 3, 2);
+    genann *copy = genann_copy(ann);
+    lequal(genann_train_batch(ann, ds->input, ds->output, 3, .5), 0);
+    lequal(genann_train_batch(copy, input, output, 3, .5), 0);
+    for (i = 0; i < ann->total_weights; ++i) lok(ann->weight[i] == copy->weight[i]);
+    genann_free(ann);
+    genann_free(copy);
+    genann_dataset_close(ds);
+
+    /* Numeric outputs, written from memory. */
+    out = fopen("persist.ds", "wb");
+    lequal(genann_dataset_write(out, 3, 2, 1, input, output), 0);
+    fclose(out);
+    ds = genann_dataset_open("persist.ds");
+    lok(ds != NULL);
+    lequal((int)ds->rows, 1);
+    for (i = 0; i < 3; ++i) lok(ds->input[i] == input[i]);
+    for (i = 0; i < 2; ++i) lok(ds->output[i] == output[i]);
+    genann_dataset_close(ds);
+
+    /* A file of the other precision is read and converted. */
+    const unsigned one = 1;
+    if (*(const unsigned char*)&one == 1) {
+        unsigned char header[64] = "GENANND";
+        const float sf[] = {1.5, -2, .25, 4};
+        const double sd[] = {1.5, -2, .25, 4};
+        header[8] = 1;
+        header[12] = 4; header[13] = 3; header[14] = 2; header[15] = 1;
+        header[16] = SINGLE ? sizeof(double) : sizeof(float);
+        header[20] = 2;
+        header[24] = 1;
+        header[32] = 1;
+        f = fopen("persist.ds", "wb");
+        fwrite(header, 64, 1, f);
+        if (SINGLE) fwrite(sd, sizeof(sd), 1, f);
+        else fwrite(sf, sizeof(sf), 1, f);
+        fclose(f);
+
+        ds = genann_dataset_open("persist.ds");
+        lok(ds != NULL);
+        lok(ds->mapping_size == 0);
+        for (i = 0; i < 2; ++i) lok(ds->input[i] == sd[i]);
+        lok(ds->output[0] == sd[2]);
+        genann_dataset_close(ds);
+    }
+
+    /* A missing value, and a third class for two outputs. */
+    const char *bad[] = {"1,2,3\n4,5\n", "1,2,x\n1,2,y\n1,2,z\n"};
+    for (i = 0; i < 2; ++i) {
+        f = fopen("persist.csv", "w");
+        fputs(bad[i], f);
+        fclose(f);
+        in = fopen("persist.csv", "r");
+        out = fopen("persist.ds", "wb");
+        lequal((int)genann_dataset_convert_csv(in, out, 2, i ? 2 : 1), -1);
+        fclose(in);
+        fclose(out);
+    }
+
+    lok(genann_dataset_open("persist.csv") == NULL);
+    lok(genann_dataset_open("no such file") == NULL);
+}
+
+
+static int fit_log(genann_fit_epoch const *e, void *user) {
+    genann_fit_epoch *log = user;
+    log[e->epoch - 1] = *e;
+    return e->epoch == 3;
+}
+
+
+void fit() {
+    /* AND of two inputs, on a grid. */
+    genann_real input[2*64], output[64];
+    int i, j;
+    for (i = 0; i < 64; ++i) {
+        input[2*i] = (i % 8) / 7.0;
+        input[2*i+1] = (i / 8) / 7.0;
+        output[i] = input[2*i] > .5 && input[2*i+1] > .5;
+    }
+
+    FILE *out = fopen("persist.ds", "wb");
+    lequal(genann_dataset_write(out, 2, 1, 64, input, output), 0);
+    fclose(out);
+    genann_dataset *ds = genann_dataset_open("persist.ds");
+
+    genann *ann = genann_init(2, 1, 4, 1);
+    genann *copy = genann_copy(ann);
+    genann_threadpool *pool = genann_threadpool_init(3);
+
+    genann_fit_options opt;
+    genann_fit_defaults(&opt);
+    opt.learning_rate = 1;
+    opt.patience = 20;
+    opt.seed = 7;
+
+    /* Stops early, and keeps the best epoch's weights. */
+    genann_fit_epoch best, again;
+    const int epochs = genann_fit(ann, ds, &opt, &best);
+    lok(epochs > 20 && epochs < opt.max_epochs);
+    lok(best.epoch == epochs - 20);
+    lok(best.validation_loss < .05);
+    lok(best.train_loss < .1);
+    lok(best.rows_per_second > 0);
+
+    /* The same seed with a pool gives the same run. */
+    opt.pool = pool;
+    lequal(genann_fit(copy, ds, &opt, &again), epochs);
+    lequal(again.epoch, best.epoch);
+    lfequal(again.validation_loss, best.validation_loss);
+    for (i = 0; i < ann->total_weights; ++i) lok(ann->weight[i] == copy->weight[i]);
+
+    /* The report can stop training, and sees the schedule. */
+    genann_fit_epoch log[3];
+    opt.pool = 0;
+    opt.validation = 0;
+    opt.schedule = GENANN_FIT_STEP;
+    opt.step = 2;
+    opt.report = fit_log;
+    opt.user = log;
+    lequal(genann_fit(ann, ds, &opt, &best), 3);
+    for (j = 0; j < 3; ++j) {
+        lequal(log[j].epoch, j + 1);
+        lok(log[j].validation_loss != log[j].validation_loss);
+    }
+    lfequal(log[1].learning_rate, 1);
+    lfequal(log[2].learning_rate, .5);
+
+    opt.schedule = GENANN_FIT_COSINE;
+    opt.max_epochs = 4;
+    lequal(genann_fit(ann, ds, &opt, 0), 3);
+    lfequal(log[0].learning_rate, 1);
+    lfequal(log[2].learning_rate, .5);
+
+    /* The dataset must fit the ann. */
+    genann *wide = genann_init(3, 1, 4, 1);
+    lequal(genann_fit(wide, ds, 0, 0), -1);
+
+    genann_free(wide);
+    genann_threadpool_free(pool);
+    genann_free(copy);
+    genann_free(ann);
+    genann_dataset_close(ds);
+}
+
+
+static genann_real times_two(const genann *ann, genann_real a) {
+    (void)ann;
+    return 2 * a;
+}
+
+
+void export_c() {
+    /* The middle layer is big enough to come out as loops. */
+    const int sizes[] = {3, 5, 60, 2};
+    genann *ann = genann_init_layers(4, sizes);
+    genann_set_activation_layer(ann, 1, &genann_activation_tanh);
+    genann_set_activation_layer(ann, 2, &genann_activation_relu);
+    genann_set_activation_layer(ann, 3, &genann_activation_sigmoid);
+
+    FILE *out = fopen("persist_export.c", "w");
+    lequal(genann_export_c(ann, out, "2net"), -1);
+    lequal(genann_export_c(ann, out, "net-1"), -1);
+    lequal(genann_export_c(ann, out, "net"), 0);
+
+    const char *type = SINGLE ? "float" : "double";
+    fprintf(out, "\n#include <stdio.h>\n\nint main(void) {\n");
+    fprintf(out, "    double x[3];\n    %s in[3], out[2];\n", type);
+    fprintf(out, "    while (scanf(\"%%lf %%lf %%lf\", x, x + 1, x + 2) == 3) {\n");
+    fprintf(out, "        in[0] = x[0]; in[1] = x[1]; in[2] = x[2];\n");
+    fprintf(out, "        net(in, out);\n");
+    fprintf(out, "        printf(\"%%.17g %%.17g\\n\", (double)out[0], (double)out[1]);\n");
+    fprintf(out, "    }\n    return 0;\n}\n");
+    fclose(out);
+
+    lequal(system("cc -std=c99 -Wall -Wextra -Werror -O2 -o persist_export persist_export.c -lm"), 0);
+
+    genann_real input[20 * 3];
+    int i, j;
+    out = fopen("persist.txt", "w");
+    for (i = 0; i < 20 * 3; ++i) {
+        input[i] = (i * 37 % 23) / 11.0 - 1;
+        fprintf(out, "%.17g%c", (double)input[i], i % 3 == 2 ? '\n' : ' ');
+    }
+    fclose(out);
+
+    lequal(system("./persist_export < persist.txt > persist.csv"), 0);
+
+    FILE *in = fopen("persist.csv", "r");
+    for (i = 0; i < 20; ++i) {
+        genann_real const *expected = genann_run(ann, input + i * 3);
+        for (j = 0; j < 2; ++j) {
+            double d = 0;
+            lequal(fscanf(in, "%lf", &d), 1);
+            lok(fabs(d - expected[j]) < (SINGLE ? 1e-5 : 1e-12));
+        }
+    }
+    fclose(in);
+
+    /* What can't be built in. */
+    genann_activation twice = {GENANN_ACT_CUSTOM, times_two, 0, 0, 0};
+    out = fopen("persist_export.c", "w");
+    genann_set_activation_layer(ann, 2, &twice);
+    lequal(genann_export_c(ann, out, "net"), -1);
+    genann_set_activation_layer(ann, 2, &genann_activation_relu);
+    ann->weight[7] = NAN;
+    lequal(genann_export_c(ann, out, "net"), -1);
+    fclose(out);
+
+    genann_free(ann);
+}
+
+
 void copy() {
     genann *first = genann_init(1000, 5, 50, 10);
 
@@ -342,15 +1212,354 @@ void copy() {
 }
 
 
+void stats() {
+    genann_stats st;
+    genann_real in[2] = {.5, -1}, out[1] = {1};
+    int i;
+
+    if (genann_stats_snapshot(&st) != 0) {
+        /* Built without GENANN_STATS. */
+        lequal((int)st.run_calls, 0);
+        lequal((int)st.flops, 0);
+        return;
+    }
+
+    genann *ann = genann_init(2, 1, 3, 1);
+    genann_workspace *ws = genann_workspace_init(ann);
+
+    genann_stats_reset();
+    for (i = 0; i < 5; ++i) genann_run(ann, in);
+    genann_train(ann, in, out, .1);
+    genann_train(ann, in, out, .1);
+    genann_train_ws(ann, ws, in, out, .1);
+    genann_stats_snapshot(&st);
+
+    lequal((int)st.run_calls, 5);
+    lequal((int)st.train_calls, 3);
+
+    /* 13 weights: 26 flops per forward pass, then 6 for the hidden deltas
+     * and 26 for the update on each training step. */
+    lequal((int)st.flops, 8 * 26 + 3 * (6 + 26));
+    lequal((int)st.bytes, (int)sizeof(genann_real) * (8 * 13 + 3 * (3 + 26)));
+    lequal((int)st.forward_cycles[2], 0);
+    lequal((int)st.backward_cycles[2], 0);
+    lequal((int)st.activation_cycles[2], 0);
+    lequal((int)st.update_cycles[2], 0);
+
+    /* Each phase of the output layer is timed separately. Elsewhere clock()
+     * is too coarse to see any of them. */
+#if defined(__x86_64__) || defined(__i386__)
+    lok(st.forward_cycles[1] > 0);
+    lok(st.backward_cycles[1] > 0);
+    lok(st.activation_cycles[1] > 0);
+    lok(st.update_cycles[1] > 0);
+#endif
+
+    /* A team run counts once, with every slice of its wide layer. */
+    genann *wide = genann_init(200, 1, 100, 1);
+    genann_team *team = genann_team_init(2);
+    genann_real wide_in[200] = {0};
+    genann_stats_reset();
+    genann_run_team(team, wide, wide_in);
+    genann_stats_snapshot(&st);
+    lequal((int)st.run_calls, 1);
+    lequal((int)st.flops, 2 * wide->total_weights);
+    lok(st.forward_cycles[0] > 0);
+    genann_team_free(team);
+    genann_free(wide);
+
+    genann_stats_reset();
+    genann_stats_snapshot(&st);
+    lequal((int)st.run_calls, 0);
+    lequal((int)st.forward_cycles[0], 0);
+    lequal((int)st.update_cycles[0], 0);
+
+    genann_workspace_free(ws);
+    genann_free(ann);
+}
+
+
+void sparse() {
+    genann_real in[6], out[3] = {.2, .9, .4};
+    int i, j;
+
+    genann *ann = genann_init(6, 2, 12, 3);
+    genann_set_activation_hidden(ann, &genann_activation_tanh);
+    for (i = 0; i < 6; ++i) in[i] = GENANN_RANDOM() * 2 - 1;
+
+    /* Nothing pruned. */
+    genann_sparse *s = genann_prune(ann, 0);
+    lequal(s->total_weights, ann->total_weights - (ann->total_neurons - ann->inputs));
+    genann_real const *expected = genann_run(ann, in);
+    genann_real const *actual = genann_sparse_run(s, in);
+    for (j = 0; j < 3; ++j) lok(fabs(actual[j] - expected[j]) < REAL_TOLERANCE);
+    genann_sparse_free(s);
+
+    /* 80% pruned must match a dense ann with those weights zeroed. */
+    const double threshold = genann_prune_threshold(ann, .8);
+    s = genann_prune(ann, threshold);
+    lequal(s->total_weights, 252 - (int)(.8 * 252));
+
+    genann *zeroed = genann_copy(ann);
+    int l, k, w = 0;
+    for (l = 1; l <= ann->layers; ++l) {
+        for (j = 0; j < ann->layer_size[l]; ++j) {
+            ++w;
+            for (k = 0; k < ann->layer_size[l-1]; ++k, ++w) {
+                if (fabs(zeroed->weight[w]) < threshold) zeroed->weight[w] = 0;
+            }
+        }
+    }
+
+    expected = genann_run(zeroed, in);
+    actual = genann_sparse_run(s, in);
+    for (j = 0; j < 3; ++j) lok(fabs(actual[j] - expected[j]) < REAL_TOLERANCE);
+
+    /* Training moves the same weights, and leaves the pruned ones at 0. */
+    genann *before = genann_copy(zeroed);
+    genann_sparse_train(s, in, out, .5);
+    genann_train(zeroed, in, out, .5);
+
+    genann *dense = genann_sparse_dense(s);
+    lequal(dense->total_weights, ann->total_weights);
+    lok(dense->activation_hidden == genann_act_tanh);
+    for (i = 0; i < ann->total_weights; ++i) {
+        if (before->weight[i] == 0) lfequal(dense->weight[i], 0);
+        else lok(fabs(dense->weight[i] - zeroed->weight[i]) < REAL_TOLERANCE);
+    }
+
+    /* Saving keeps only the weights that remain. */
+    FILE *f = fopen("persist.bin", "wb");
+    lequal(genann_sparse_write(s, f), 0);
+    const long size = ftell(f);
+    fclose(f);
+    lok(size < 64 + (long)sizeof(genann_real) * ann->total_weights);
+
+    f = fopen("persist.bin", "rb");
+    genann_sparse *loaded = genann_sparse_read(f);
+    fclose(f);
+    lok(loaded != 0);
+    lequal(loaded->total_weights, s->total_weights);
+    for (i = 0; i < s->total_weights; ++i) {
+        lequal(loaded->index[i], s->index[i]);
+        lfequal(loaded->weight[i], s->weight[i]);
+    }
+    expected = genann_sparse_run(s, in);
+    actual = genann_sparse_run(loaded, in);
+    for (j = 0; j < 3; ++j) lfequal(actual[j], expected[j]);
+
+    /* Counts in the header that don't fit the layers or the file. */
+    unsigned char image[4096];
+    f = fopen("persist.bin", "rb");
+    const size_t length = fread(image, 1, sizeof(image), f);
+    fclose(f);
+    lok(length < sizeof(image));
+    const long long bad_counts[] = {0x7fffffff, s->total_weights + 1};
+    for (j = 0; j < 2; ++j) {
+        unsigned char patched[4096];
+        memcpy(patched, image, length);
+        for (i = 0; i < 4; ++i) patched[44 + i] = (unsigned char)(bad_counts[j] >> (8 * i));
+        f = fopen("persist.bin", "wb");
+        fwrite(patched, 1, length, f);
+        fclose(f);
+        f = fopen("persist.bin", "rb");
+        lok(genann_sparse_read(f) == 0);
+        fclose(f);
+    }
+    f = fopen("persist.bin", "wb");
+    fwrite(image, 1, length, f);
+    fclose(f);
+
+    /* Dense readers reject it, and the sparse reader rejects dense files. */
+    f = fopen("persist.bin", "rb");
+    lok(genann_read_binary(f) == 0);
+    fclose(f);
+
+    f = fopen("persist.bin", "wb");
+    genann_write_binary(ann, f);
+    fclose(f);
+    f = fopen("persist.bin", "rb");
+    lok(genann_sparse_read(f) == 0);
+    fclose(f);
+
+    genann_sparse_free(loaded);
+    genann_sparse_free(s);
+    genann_free(dense);
+    genann_free(before);
+    genann_free(zeroed);
+    genann_free(ann);
+}
+
+
+void copy_into() {
+    genann *a = genann_init(3, 1, 4, 2);
+    genann *b = genann_init(3, 1, 4, 2);
+    genann *c = genann_init(3, 2, 4, 2);
+    const genann_real in[3] = {.1, -.4, .8};
+    int i;
+
+    genann_set_activation_hidden(a, &genann_activation_tanh);
+
+    lequal(genann_copy_weights(b, a), 0);
+    for (i = 0; i < a->total_weights; ++i) lfequal(b->weight[i], a->weight[i]);
+    lok(b->activation_hidden != genann_act_tanh);
+
+    lequal(genann_copy_into(b, a), 0);
+    lok(b->activation_hidden == genann_act_tanh);
+    lfequal(genann_run(b, in)[1], genann_run(a, in)[1]);
+
+    lequal(genann_copy_into(c, a), -1);
+    lequal(genann_copy_weights(c, a), -1);
+
+    genann_free(a);
+    genann_free(b);
+    genann_free(c);
+}
+
+
+void arena() {
+    genann_arena *arena = genann_arena_init(1 << 16);
+    genann *anns[1000];
+    const genann_real in[4] = {1, 0, -1, .5};
+    int n = 0, i;
+
+    /* Fill it up. */
+    while (n < 1000 && (anns[n] = genann_init_in(arena, 4, 1, 8, 2))) ++n;
+    lok(n > 10 && n < 1000);
+    for (i = 0; i < n; ++i) lok((size_t)anns[i] % 64 == 0);
+
+    genann *a = anns[n / 2];
+    genann *copy = genann_copy(a);
+    lfequal(genann_run(a, in)[0], genann_run(copy, in)[0]);
+
+    /* Freed memory goes to the next ann of the same size. */
+    genann_free(a);
+    lok(genann_init_in(arena, 4, 1, 30, 2) == 0);
+    anns[n / 2] = genann_copy_in(arena, copy);
+    lok(anns[n / 2] == a);
+    lfequal(genann_run(anns[n / 2], in)[0], genann_run(copy, in)[0]);
+
+    genann_arena_reset(arena);
+    lok(genann_init_in(arena, 4, 1, 8, 2) == anns[0]);
+
+    genann_free(copy);
+    genann_arena_free(arena);
+}
+
+
+void run_batch() {
+    const int topo[][4] = {{3, 0, 0, 2}, {2, 1, 2, 1}, {7, 3, 5, 4}, {300, 2, 40, 3}};
+    const int n = 37; /* Not a multiple of the block size. */
+    int t, i, j;
+
+    for (t = 0; t < 4; ++t) {
+        genann *ann = genann_init(topo[t][0], topo[t][1], topo[t][2], topo[t][3]);
+        genann_real *inputs = malloc(sizeof(genann_real) * n * ann->inputs);
+        genann_real *outputs = malloc(sizeof(genann_real) * n * ann->outputs);
+
+        for (i = 0; i < n * ann->inputs; ++i) {
+            inputs[i] = GENANN_RANDOM() * 4 - 2;
+        }
+
+        lequal(genann_run_batch(ann, inputs, n, outputs), 0);
+
+        for (i = 0; i < n; ++i) {
+            genann_real const *out = genann_run(ann, inputs + i * ann->inputs);
+            for (j = 0; j < ann->outputs; ++j) {
+                lok(fabs(out[j] - outputs[i * ann->outputs + j]) < REAL_TOLERANCE);
+            }
+        }
+
+        /* A batch workspace gives the same outputs; a plain one has no room. */
+        genann_workspace *ws = genann_workspace_init_batch(ann);
+        genann_workspace *plain = genann_workspace_init(ann);
+        genann_real *again = malloc(sizeof(genann_real) * n * ann->outputs);
+        lequal(genann_run_batch_ws(ann, ws, inputs, n, again), 0);
+        for (i = 0; i < n * ann->outputs; ++i) lok(again[i] == outputs[i]);
+        lequal(genann_run_batch_ws(ann, plain, inputs, n, again), -1);
+        lok(genann_run_ws(ann, ws, inputs)[0] == genann_run(ann, inputs)[0]);
+
+        free(again);
+        genann_workspace_free(plain);
+        genann_workspace_free(ws);
+        free(inputs);
+        free(outputs);
+        genann_free(ann);
+    }
+}
+
+
+void quantize() {
+    const int n = 64;
+    int i;
+
+    genann *ann = genann_init(10, 2, 16, 3);
+    ann->activation_hidden = genann_act_tanh;
+
+    /* Fixed, varied weights and inputs keep this test deterministic. */
+    for (i = 0; i < ann->total_weights; ++i) ann->weight[i] = sin(i * 1.7);
+
+    genann_real *inputs = malloc(sizeof(genann_real) * n * ann->inputs);
+    for (i = 0; i < n * ann->inputs; ++i) inputs[i] = cos(i * .37);
+
+    genann_q8 *q = genann_quantize(ann);
+    lequal(q->total_weights, ann->total_weights);
+
+    const double err = genann_q8_error(q, ann, inputs, n);
+    lok(err >= 0);
+    lok(err < .02);
+
+    genann_real const *out = genann_q8_run(q, inputs);
+    lok(fabs(out[0] - genann_run(ann, inputs)[0]) <= err);
+
+    genann_q8_free(q);
+    free(inputs);
+    genann_free(ann);
+
+    /* Long rows take the chunked accumulation path. */
+    ann = genann_init(70000, 0, 0, 1);
+    ann->activation_output = genann_act_linear;
+    inputs = malloc(sizeof(genann_real) * ann->inputs);
+    for (i = 0; i < ann->inputs; ++i) {
+        inputs[i] = 1;
+        ann->weight[i + 1] = 1;
+    }
+    ann->weight[0] = -5;
+
+    q = genann_quantize(ann);
+    lfequal(*genann_q8_run(q, inputs), 70005);
+
+    genann_q8_free(q);
+    free(inputs);
+    genann_free(ann);
+}
+
+
 void sigmoid() {
     double i = -20;
     const double max = 20;
     const double d = .0001;
+    double worst = 0;
 
     while (i < max) {
-        lfequal(genann_act_sigmoid(NULL, i), genann_act_sigmoid_cached(NULL, i));
+        const double e = fabs(genann_act_sigmoid(NULL, i) - genann_act_sigmoid_cached(NULL, i));
+        if (e > worst) worst = e;
         i += d;
     }
+
+    lok(worst < 2e-5);
+
+    /* The whole-layer form must agree with the scalar one. */
+    genann_real a[37], b[37];
+    int j;
+    for (j = 0; j < 37; ++j) a[j] = b[j] = (j - 18) * .97;
+    genann_activation_sigmoid_cached.forward_layer(NULL, a, 37);
+    for (j = 0; j < 37; ++j) lok(fabs(a[j] - genann_act_sigmoid_cached(NULL, b[j])) < 1e-6);
+
+    /* The whole-layer form passes a NaN through. */
+    a[0] = NAN;
+    genann_activation_sigmoid_cached.forward_layer(NULL, a, 1);
+    lok(isnan(a[0]));
 }
 
 
@@ -363,6 +1572,7 @@ int main(int argc, char *argv[])
     lrun("basic", basic);
     lrun("xor", xor);
     lrun("backprop", backprop);
+    lrun("train ex", train_ex);
     lrun("train and", train_and);
     lrun("train or", train_or);
     lrun("train xor", train_xor);
@@ -370,8 +1580,29 @@ int main(int argc, char *argv[])
     lrun("train relu", train_xor_relu);
     lrun("gradient tanh", gradient_tanh);
     lrun("gradient relu", gradient_relu);
+    lrun("custom act", gradient_custom);
+    lrun("workspace", workspace);
+    lrun("train batch", train_batch);
+    lrun("batch xor", train_batch_xor);
+    lrun("optimizer", optimizer_first_step);
+    lrun("optimizer xor", optimizer_xor);
+    lrun("train threads", train_threads);
+    lrun("run team", run_team);
+    lrun("evolve", evolve);
     lrun("persist", persist);
+    lrun("persist bin", persist_binary);
+    lrun("persist mmap", persist_mmap);
+    lrun("export c", export_c);
+    lrun("dataset", dataset);
+    lrun("fit", fit);
     lrun("copy", copy);
+    lrun("copy into", copy_into);
+    lrun("arena", arena);
+    lrun("layers", layers);
+    lrun("stats", stats);
+    lrun("sparse", sparse);
+    lrun("run batch", run_batch);
+    lrun("quantize", quantize);
     lrun("sigmoid", sigmoid);
 
     lresults();